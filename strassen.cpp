@@ -1,29 +1,180 @@
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <charconv>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#ifdef STRASSEN_MPI
+#include <mpi.h>
+#endif
+#ifdef STRASSEN_OFFLOAD
+#include <omp.h>
+#endif
+
 enum debug_flags {
     RANDOM = 0x01,  // should generate random instead of reading from a file
     PRINT = 0x02,   // print matrices to the screen
     VERIFY = 0x04,  // verify the matrix multiplication
     TIME = 0x08,    // time the functions
+    TUNE = 0x10,    // tune the cutoff and write it to the profile in INPUT
+    BENCH = 0x20,   // run the benchmark sweep and write the report to INPUT
+    SERVE = 0x40,   // serve multiplications on the UNIX socket INPUT
 };
 
+// Tuning profiles are per machine, by default they live in the home directory
+static std::string default_profile_path() {
+    const char* home = std::getenv("HOME");
+    if (home == nullptr) return "strassen.profile";
+    return std::string(home) + "/.strassen_profile";
+}
+
 static int usage() {
-    std::cerr << "      Usage: ./strassen [DEBUG] [DIMENSION] [INPUT]\n";
+    std::cerr << "      Usage: ./strassen [DEBUG] [DIMENSION] [INPUT] "
+                 "[OPTIONS]\n";
     std::cerr << "          debug flags:\n";
     std::cerr << "              RANDOM      :" << debug_flags::RANDOM << "\n";
     std::cerr << "              PRINT       :" << debug_flags::PRINT << "\n";
     std::cerr << "              VERIFY      :" << debug_flags::VERIFY << "\n";
     std::cerr << "              TIME        :" << debug_flags::TIME << "\n";
+    std::cerr << "              TUNE        :" << debug_flags::TUNE << "\n";
+    std::cerr << "              BENCH       :" << debug_flags::BENCH << "\n";
+    std::cerr << "              SERVE       :" << debug_flags::SERVE << "\n";
+    std::cerr << "          options:\n";
+    std::cerr << "              --threads N      : worker threads (1)\n";
+    std::cerr << "              --spawn-depth D  : recursion levels which "
+                 "spawn tasks\n";
+    std::cerr << "              --profile PATH   : tuned cutoff profile ("
+              << default_profile_path() << ")\n";
+    std::cerr << "              --layout L       : row-major or morton "
+                 "storage for the recursion (row-major)\n";
+    std::cerr << "              --algorithm A    : classic or winograd "
+                 "schedule (classic)\n";
+    std::cerr << "              --write-binary PATH : save the inputs in the "
+                 "binary INPUT format\n";
+    std::cerr << "              --out-of-core DIR   : keep the operands in a "
+                 "tiled file in DIR\n";
+    std::cerr << "              --memory MB         : in-core budget of "
+                 "--out-of-core (1024)\n";
+    std::cerr << "              --batch N           : INPUT holds N pairs "
+                 "A0 B0 A1 B1 ... (1)\n";
+    std::cerr << "              --element E         : int8, int16, int32, "
+                 "int64, float or double (int32)\n";
+    std::cerr << "              --accumulate A      : int32 or int64 type "
+                 "narrower integers compute in,\n"
+                 "                                    int8 and int16 are only "
+                 "read narrow (int32)\n";
+    std::cerr << "              --modulus P         : reduce the integer "
+                 "product modulo P, the product of the\n"
+                 "                                    reduced inputs has to "
+                 "fit the element type\n";
+    std::cerr << "              --boolean M         : bit-packed 0/1 product, "
+                 "count or gf2\n";
+    std::cerr << "              --output SPEC       : only compute diagonal, "
+                 "trace, rows:F-L, columns:F-L\n"
+                 "                                    or entries:I,J;... of C "
+                 "(full)\n";
+    std::cerr << "              --shape M,K,N       : multiply an M x K A by "
+                 "a K x N B\n";
+    std::cerr << "              --chain D0,...,DN   : product of the Di x "
+                 "D(i+1) factors in INPUT\n";
+    std::cerr << "              --power K           : A^K of the DIMENSION "
+                 "square A\n";
+    std::cerr << "              --distribute L      : spread the top L levels "
+                 "over the MPI ranks\n";
+    std::cerr << "              --schedule S        : bfs or dfs order of "
+                 "--distribute (bfs)\n";
+    std::cerr << "              --numa P            : none, local or "
+                 "interleave placement and pinning (none)\n";
+    std::cerr << "              --in-flight N       : products SERVE runs at "
+                 "once (2)\n";
+    std::cerr << "              --connect SOCKET    : multiply on a SERVE "
+                 "daemon\n";
+    std::cerr << "              --requests N        : pipelined products of "
+                 "--connect (1)\n";
+    std::cerr << "              --triangles P,...   : count triangles of "
+                 "G(DIMENSION, P), INPUT is the cutoff\n";
+    std::cerr << "              --verify V          : exact or freivalds "
+                 "VERIFY (exact)\n";
+    std::cerr << "              --rounds K          : random vectors of "
+                 "--verify freivalds (16)\n";
+    std::cerr << "              --seed S            : seed of the RANDOM "
+                 "inputs (the time)\n";
+    std::cerr << "              --range LO,HI       : integer range of the "
+                 "RANDOM entries (0,1)\n";
+    std::cerr << "              --density D         : share of non-zero "
+                 "RANDOM entries (1)\n";
+    std::cerr << "          benchmark options, INPUT is a .csv or .json "
+                 "report or - for stdout:\n";
+    std::cerr << "              --sizes N,...         : dimensions "
+                 "(DIMENSION)\n";
+    std::cerr << "              --cutoffs C,...       : cutoffs (profile)\n";
+    std::cerr << "              --thread-counts T,... : thread counts "
+                 "(--threads)\n";
+    std::cerr << "              --algorithms A,...    : strassen, winograd, "
+                 "blocked and/or linear (all)\n";
+    std::cerr << "              --warmup W            : untimed runs (1)\n";
+    std::cerr << "              --repeat R            : timed runs (5)\n";
+    std::cerr << "              --peak GOPS           : report the share of "
+                 "this peak\n";
 
     return -1;
 }
 
+// Moves '--name value' pairs from 'args' into 'options', leaving only the
+//  positional arguments, returns false on a flag without a value
+static bool parse_options(std::vector<std::string>& args,
+                          std::map<std::string, std::string>& options) {
+    std::vector<std::string> positional;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i].rfind("--", 0) != 0) {
+            positional.push_back(args[i]);
+            continue;
+        }
+        if (i + 1 == args.size()) return false;
+        options[args[i].substr(2)] = args[i + 1];
+        ++i;
+    }
+
+    args = positional;
+    return true;
+}
+
 static int to_int(std::string str) {
     int res;
     std::stringstream ss;
@@ -34,11 +185,28 @@ static int to_int(std::string str) {
     return res;
 }
 
+// Parses the comma separated positive integers of option 'name' into
+//  'values', a missing option leaves 'fallback'
+static bool parse_counts(std::map<std::string, std::string>& options,
+                         const std::string& name, int fallback,
+                         std::vector<int>& values) {
+    values.assign(1, fallback);
+    if (options.count(name) == 0) return fallback > 0;
+
+    values.clear();
+    std::stringstream list(options[name]);
+    for (std::string item; getline(list, item, ',');) {
+        values.push_back(to_int(item));
+        if (values.back() <= 0) return false;
+    }
+    return !values.empty();
+}
+
 static void time(std::function<void(void)> func) {
     // Perform the multiplications
-    auto start = std::chrono::system_clock::now();
+    auto start = std::chrono::steady_clock::now();
     func();
-    auto end = std::chrono::system_clock::now();
+    auto end = std::chrono::steady_clock::now();
 
     auto dur = end - start;
     auto s = std::chrono::duration_cast<std::chrono::seconds>(dur);
@@ -49,100 +217,288 @@ static void time(std::function<void(void)> func) {
 
 static inline int ceil_divide(int x) { return x / 2 + (x % 2 != 0); }
 
-int padding_size(int dimension, int cutoff) {
-    int power = 0;
-    while (dimension > cutoff) {
-        power++;
-        dimension = ceil_divide(dimension);
+// Non-owning, trivially copyable window into a matrix. It spans a logical
+//  'dimension' x 'dimension' block of which only the top left 'rows' x 'cols'
+//  are backed by memory, everything past them reads as zero.
+//
+// The storage is row-major with 'stride', unless 'tile' is set: then a block
+//  above the tile dimension is Morton ordered, i.e. its four quadrants are
+//  stored one after another (00, 01, 10, 11) down to contiguous row-major
+//  'tile' x 'tile' leaves. Morton blocks are always fully backed
+template <typename T>
+struct matrix_view {
+    T* data;
+    int stride;
+    int rows, cols;
+    int dimension;
+    int tile = 0;
+
+    matrix_view(T* data, int stride, int dimension)
+        : matrix_view(data, stride, dimension, dimension, dimension) {}
+
+    matrix_view(T* data, int stride, int rows, int cols, int dimension)
+        : data(data), stride(stride), rows(rows), cols(cols),
+          dimension(dimension) {}
+
+    // Morton ordered 'dimension' x 'dimension' block with 'tile' leaves
+    static matrix_view morton(T* data, int dimension, int tile) {
+        matrix_view view(data, std::min(dimension, tile), dimension);
+        view.tile = tile;
+        return view;
     }
-    return dimension * (1 << power);
-}
 
-// Represents a two dimension set of integers
-class matrix_data {
-   public:
-    int dimension;
-    std::shared_ptr<std::vector<int>> data;
+    // Is this a Morton block above the leaf tiles, where 'row()' and 'at()'
+    //  don't apply and the storage is a contiguous 'dimension^2' run
+    bool blocked() const { return tile != 0 && dimension > tile; }
+
+    // Does the storage cover the whole 'dimension' square, false for views
+    //  clipped to the backed extent of a padded matrix
+    bool backed() const { return rows == dimension && cols == dimension; }
+
+    // Quadrant '(x, y)' of the block split in halves, rounding up
+    matrix_view sub(int x, int y) const {
+        int half = ceil_divide(dimension);
+        if (blocked()) {
+            size_t quadrant = size_t(half) * half;
+            return morton(data + (2 * x + y) * quadrant, half, tile);
+        }
+
+        int r = std::max(0, std::min(half, rows - x * half));
+        int c = std::max(0, std::min(half, cols - y * half));
+
+        T* corner = data;
+        if (r > 0 && c > 0) corner += ptrdiff_t(x) * half * stride + y * half;
+        return matrix_view(corner, stride, r, c, half);
+    }
+
+    // The top left 'dimension' x 'dimension' block of a row-major view
+    matrix_view top_left(int dimension) const {
+        assert(!blocked());
+        return matrix_view(data, stride, std::min(rows, dimension),
+                           std::min(cols, dimension), dimension);
+    }
 
-    matrix_data(int dimension) : dimension(dimension) {
-        data = std::make_shared<std::vector<int>>(dimension * dimension, 0);
+    inline bool in_bounds(int x, int y) const {
+        return x >= 0 && y >= 0 && x < rows && y < cols;
     }
 
-    inline bool in_bounds(int i, int j) const {
-        return i >= 0 && j >= 0 && i + dimension * j < int(data->size());
+    // Checked read in either layout, zero outside of the backed region
+    T get(int x, int y) const {
+        if (!in_bounds(x, y)) return T(0);
+
+        matrix_view block = *this;
+        while (block.blocked()) {
+            int half = block.dimension / 2;
+            int qx = x >= half, qy = y >= half;
+            block = block.sub(qx, qy);
+            x -= qx * half;
+            y -= qy * half;
+        }
+        return block.at(x, y);
+    }
+
+    // Unchecked row-major accessors, callers are responsible for
+    //  'in_bounds()' and '!blocked()'
+    T& at(int x, int y) const { return data[ptrdiff_t(x) * stride + y]; }
+    T* row(int x) const { return data + ptrdiff_t(x) * stride; }
+
+    void clear() const {
+        if (blocked()) {
+            std::fill(data, data + size_t(dimension) * dimension, T(0));
+            return;
+        }
+        for (int x = 0; x < rows; ++x) {
+            std::fill(row(x), row(x) + cols, T(0));
+        }
     }
 
-    int get(int i, int j) const { return data->at(j + dimension * i); }
+    bool operator==(const matrix_view& other) const {
+        if (dimension != other.dimension) return false;
+
+        for (int x = 0; x < dimension; ++x) {
+            for (int y = 0; y < dimension; ++y) {
+                if (get(x, y) != other.get(x, y)) return false;
+            }
+        }
 
-    int& at(int i, int j) { return data->at(j + dimension * i); }
-    int& at(int i) { return data->at(i); }
+        return true;
+    }
 };
 
-// Represents a submatrix which points to some two dimensional block of data
-class submatrix {
+static_assert(std::is_trivially_copyable<matrix_view<int>>::value,
+              "views are passed around by value in the recursion");
+
+// Page aligned anonymous mapping of 'count' elements whatever its size,
+//  null if the mapping fails. Nothing touches the pages until first use
+template <typename T>
+static std::shared_ptr<T> map_pages(size_t count) {
+    size_t bytes = count * sizeof(T);
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    madvise(memory, bytes, MADV_HUGEPAGE);
+    return std::shared_ptr<T>(static_cast<T*>(memory),
+                              [bytes](T* m) { munmap(m, bytes); });
+}
+
+// Allocations from this size on are mapped straight from the kernel
+static constexpr size_t lazy_allocation_min = size_t(1) << 21;
+
+// Zeroed storage of 'count' elements without a zeroing pass: large blocks are
+//  anonymous mappings whose pages the kernel zero fills on first touch, so
+//  they are only ever written by the code that uses them, and are backed
+//  by transparent huge pages where available
+template <typename T>
+static std::shared_ptr<T> lazy_allocate(size_t count) {
+    if (count * sizeof(T) >= lazy_allocation_min) {
+        std::shared_ptr<T> memory = map_pages<T>(count);
+        if (memory) return memory;
+    }
+    return std::shared_ptr<T>(new T[count](), std::default_delete<T[]>());
+}
+
+// Represents a two dimension set of 'T' elements, owns the storage that the
+//  kernels see through 'view()'. A rectangular 'rows' x 'cols' matrix is seen
+//  as the zero padded square of its longer side
+template <typename T>
+class matrix_data {
    public:
-    submatrix(matrix_data data) : data(data) {
-        i = 0;
-        j = 0;
+    int dimension;
+    int rows, cols;
 
-        dimension = data.dimension;
-    };
+    // Zero initialized heap storage
+    matrix_data(int dimension) : matrix_data(dimension, dimension) {}
 
-    matrix_data data;
-    int i, j, dimension;
+    matrix_data(int rows, int cols)
+        : dimension(std::max(rows, cols)), rows(rows), cols(cols) {
+        std::shared_ptr<T> memory = lazy_allocate<T>(size_t(rows) * cols);
+        base = memory.get();
+        owner = std::move(memory);
+    }
+
+    // Adopts 'memory' which is kept alive by 'owner', e.g. a mapped file
+    matrix_data(int dimension, T* memory, std::shared_ptr<void> owner)
+        : dimension(dimension), rows(dimension), cols(dimension),
+          owner(std::move(owner)), base(memory) {}
 
-    // Garbage variable for use in 'at()' method
-    int padding = 0;
+    T& at(int i, int j) { return base[j + size_t(cols) * i]; }
+    T& at(size_t i) { return base[i]; }
 
-    submatrix sub(int x, int y) {
-        submatrix sub(data);
+    matrix_view<T> view() {
+        return matrix_view<T>(base, cols, rows, cols, dimension);
+    }
 
-        sub.dimension = ceil_divide(dimension);
-        sub.i = i + x * sub.dimension;
-        sub.j = j + y * sub.dimension;
+   private:
+    std::shared_ptr<void> owner;
+    T* base;
+};
 
-        return sub;
+// Leaf tile of a Morton layout for 'dimension': it is halved (rounding up)
+//  until it fits under the cutoff, the padded dimension is 'tile << levels'
+static int morton_tile(int dimension, int cutoff, int& levels) {
+    levels = 0;
+    while (dimension > cutoff) {
+        levels++;
+        dimension = ceil_divide(dimension);
     }
+    return dimension;
+}
 
-    inline bool in_bounds(int x, int y) {
-        return data.in_bounds(x + i, y + j) &&
-               (x >= 0 && x < dimension && y >= 0 && y < dimension);
+// Position of leaf tile '(x, y)' in Morton order, the bits of the tile row
+//  and column are interleaved with the row bit first on every level
+static size_t morton_index(int x, int y, int levels) {
+    size_t index = 0;
+    for (int bit = levels - 1; bit >= 0; --bit) {
+        index = index * 4 + 2 * ((x >> bit) & 1) + ((y >> bit) & 1);
     }
+    return index;
+}
 
-    void clear() {
-        for (int j = 0; j < dimension; ++j) {
-            for (int i = 0; i < dimension; ++i) {
-                at(i, j) = 0;
+// Copies a row-major view into, or out of, Morton storage whose leaf tiles
+//  stay row-major. Padding tiles and strips are zero filled on the way in
+template <typename T>
+static void to_morton(matrix_view<T> src, matrix_view<T> dst) {
+    int levels = 0;
+    while ((dst.tile << levels) < dst.dimension) levels++;
+
+    int tile = dst.tile, grid = 1 << levels;
+    for (int tx = 0; tx < grid; ++tx) {
+        for (int ty = 0; ty < grid; ++ty) {
+            T* leaf =
+                dst.data + morton_index(tx, ty, levels) * size_t(tile) * tile;
+            int y0 = ty * tile;
+            int width = std::max(0, std::min(tile, src.cols - y0));
+
+            for (int x = 0; x < tile; ++x) {
+                T* out = leaf + x * tile;
+                int row = tx * tile + x;
+                int copied = row < src.rows ? width : 0;
+                if (copied > 0) std::copy_n(src.row(row) + y0, copied, out);
+                std::fill(out + copied, out + tile, T(0));
             }
         }
     }
+}
 
-    int& at(int x, int y) {
-        if (!in_bounds(x, y)) {
-            padding = 0;
-            return padding;
-        }
-        return data.at(x + i, y + j);
-    }
+template <typename T>
+static void from_morton(matrix_view<T> src, matrix_view<T> dst) {
+    int levels = 0;
+    while ((src.tile << levels) < src.dimension) levels++;
 
-    bool operator==(const submatrix& other) const {
-        if (dimension != other.dimension) return false;
+    int tile = src.tile, grid = 1 << levels;
+    for (int tx = 0; tx < grid; ++tx) {
+        for (int ty = 0; ty < grid; ++ty) {
+            const T* leaf =
+                src.data + morton_index(tx, ty, levels) * size_t(tile) * tile;
+            int y0 = ty * tile;
+            int width = std::max(0, std::min(tile, dst.cols - y0));
 
-        for (int x = 0; x < other.dimension; ++x) {
-            for (int y = 0; y < other.dimension; ++y) {
-                if (data.get(x, y) != other.data.get(x, y)) return false;
+            for (int x = 0; x < tile && tx * tile + x < dst.rows; ++x) {
+                T* out = dst.row(tx * tile + x) + y0;
+                std::copy_n(leaf + x * tile, width, out);
             }
         }
+    }
+}
 
-        return true;
+// Bump allocator over preallocated Strassen scratch. It is passed down the
+//  recursion by value, so everything a call hands to its children is
+//  released again when it returns
+template <typename T>
+class scratch_arena {
+   public:
+    scratch_arena(T* memory, size_t size) : next(memory), left(size) {}
+
+    // Square scratch matrix, Morton ordered when 'tile' is set
+    matrix_view<T> allocate(int dimension, int tile = 0) {
+        T* memory = take(size_t(dimension) * dimension);
+        if (tile != 0) return matrix_view<T>::morton(memory, dimension, tile);
+        return matrix_view<T>(memory, dimension, dimension);
     }
+
+    // Carves an independent arena of 'size' elements, e.g. for a task
+    scratch_arena split(size_t size) { return scratch_arena(take(size), size); }
+
+    // Unstructured scratch of 'size' elements
+    T* take(size_t size) {
+        assert(size <= left);
+        T* memory = next;
+        next += size;
+        left -= size;
+        return memory;
+    }
+
+   private:
+    T* next;
+    size_t left;
 };
 
 // Overloaded print operator
-std::ostream& operator<<(std::ostream& os, submatrix m) {
+template <typename T>
+std::ostream& operator<<(std::ostream& os, matrix_view<T> m) {
     for (int x = 0; x < m.dimension; ++x) {
         for (int y = 0; y < m.dimension; ++y) {
-            os << m.at(x, y) << " ";
+            os << m.get(x, y) << " ";
         }
         os << "\n";
     }
@@ -150,222 +506,5557 @@ std::ostream& operator<<(std::ostream& os, submatrix m) {
     return os;
 }
 
-// Submatrix addition with data target
-//  assumes that 'c' is cleared
-void sum(submatrix a, submatrix b, submatrix c) {
-    int dimension = c.dimension;
+// Vector kernels and runtime dispatch
+//  every instruction set provides the same row add/sub and GEMM micro kernel
+//  interface for every element type, 'select_kernels()' picks the widest one
+//  the CPU supports once at startup. 'STRASSEN_KERNEL=<name>' forces a
+//  specific set
+template <typename T>
+struct kernel_set {
+    const char* name;
 
-    for (int j = 0; j < dimension; ++j) {
-        for (int i = 0; i < dimension; ++i) {
-            c.at(i, j) = a.at(i, j) + b.at(i, j);
+    // Register tile of the micro kernel
+    int mr, nr;
+
+    // Accumulates the product of a packed 'mr' and a packed 'nr' panel into
+    //  the 'rows' x 'cols' corner of 'c'
+    void (*micro)(int kc, const T* pa, const T* pb, T* c, int ldc, int rows,
+                  int cols);
+
+    // Row kernels 'c[i] = a[i] op b[i]'
+    void (*add)(const T* a, const T* b, T* c, int n);
+    void (*sub)(const T* a, const T* b, T* c, int n);
+
+    // Row kernels 'c[i] += s * b[i]' and 'sum(a[i] * b[i])'
+    void (*axpy)(const T* b, T s, T* c, int n);
+    T (*dot)(const T* a, const T* b, int n);
+
+    // 'batch_lanes' independent 'n' x 'n' products 'c = a * b' in the
+    //  interleaved layout, see 'batch_lanes'
+    void (*batch)(const T* a, const T* b, T* c, int n);
+};
+
+// Interleaved (batch-major) layout of tiny products: entry '(i, j)' of
+//  'batch_lanes' matrices is stored as one contiguous run, so every vector
+//  lane works on a different product and tiles never straddle a row
+static constexpr int batch_lanes = 16;
+
+// Arithmetic of the kernels and operand sums: integers compute in their
+//  unsigned type, which wraps modulo 2^bits where signed overflow is
+//  undefined. Strassen only adds, subtracts and multiplies, so integer
+//  products are exact whenever their final entries fit 'T', whatever the
+//  operand sums of the levels reach on the way
+template <typename T, bool = std::is_integral<T>::value>
+struct wrapping {
+    using type = T;
+};
+
+template <typename T>
+struct wrapping<T, true> {
+    using type = typename std::make_unsigned<T>::type;
+};
+
+template <typename T>
+inline T wrap_add(T a, T b) {
+    using W = typename wrapping<T>::type;
+    return T(W(a) + W(b));
+}
+
+template <typename T>
+inline T wrap_sub(T a, T b) {
+    using W = typename wrapping<T>::type;
+    return T(W(a) - W(b));
+}
+
+template <typename T>
+inline T wrap_mul(T a, T b) {
+    using W = typename wrapping<T>::type;
+    return T(W(a) * W(b));
+}
+
+// Portable kernels, templates over the element type which the compiler
+//  vectorizes. They are always inlined, so the wrappers of the wider
+//  instruction sets below get them compiled for their target
+
+template <typename T>
+__attribute__((always_inline)) inline void add_scalar(const T* a, const T* b,
+                                                      T* c, int n) {
+    for (int i = 0; i < n; ++i) c[i] = wrap_add(a[i], b[i]);
+}
+
+template <typename T>
+__attribute__((always_inline)) inline void sub_scalar(const T* a, const T* b,
+                                                      T* c, int n) {
+    for (int i = 0; i < n; ++i) c[i] = wrap_sub(a[i], b[i]);
+}
+
+template <typename T>
+__attribute__((always_inline)) inline void axpy_scalar(const T* b, T s, T* c,
+                                                       int n) {
+    for (int i = 0; i < n; ++i) c[i] = wrap_add(c[i], wrap_mul(s, b[i]));
+}
+
+template <typename T>
+__attribute__((always_inline)) inline T dot_scalar(const T* a, const T* b,
+                                                   int n) {
+    T dot = T(0);
+    for (int i = 0; i < n; ++i) dot = wrap_add(dot, wrap_mul(a[i], b[i]));
+    return dot;
+}
+
+template <typename T>
+__attribute__((always_inline)) inline void batch_scalar(const T* a,
+                                                        const T* b, T* c,
+                                                        int n) {
+    constexpr int lanes = batch_lanes;
+    std::fill(c, c + size_t(n) * n * lanes, T(0));
+    for (int i = 0; i < n; ++i) {
+        T* row = c + size_t(i) * n * lanes;
+        for (int k = 0; k < n; ++k) {
+            const T* x = a + (size_t(i) * n + k) * lanes;
+            const T* y = b + size_t(k) * n * lanes;
+            for (int j = 0; j < n; ++j) {
+                for (int l = 0; l < lanes; ++l) {
+                    row[j * lanes + l] = wrap_add(
+                        row[j * lanes + l], wrap_mul(x[l], y[j * lanes + l]));
+                }
+            }
         }
     }
 }
 
-// Submatrix subtraction with data target
-//  assumes that 'c' is cleared
-void sub(submatrix a, submatrix b, submatrix c) {
-    int dimension = c.dimension;
+// Portable 'mr' x 'nr' tile (4x8 by default), written so the compiler can
+//  vectorize the inner loop
+template <typename T, int mr = 4, int nr = 8>
+__attribute__((always_inline)) inline void micro_scalar(int kc, const T* pa,
+                                                        const T* pb, T* c,
+                                                        int ldc, int rows,
+                                                        int cols) {
+    T acc[mr][nr] = {};
 
-    for (int j = 0; j < dimension; ++j) {
-        for (int i = 0; i < dimension; ++i) {
-            c.at(i, j) = a.at(i, j) - b.at(i, j);
+    for (int k = 0; k < kc; ++k) {
+        for (int x = 0; x < mr; ++x) {
+            T r = pa[x];
+            for (int y = 0; y < nr; ++y) {
+                acc[x][y] = wrap_add(acc[x][y], wrap_mul(r, pb[y]));
+            }
+        }
+        pa += mr;
+        pb += nr;
+    }
+
+    for (int x = 0; x < rows; ++x) {
+        for (int y = 0; y < cols; ++y) {
+            c[x * ldc + y] = wrap_add(c[x * ldc + y], acc[x][y]);
         }
     }
 }
 
-void linear_mul(submatrix a, submatrix b, submatrix c) {
-    int dimension = c.dimension;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
 
-    for (int k = 0; k < dimension; ++k) {
-        for (int i = 0; i < dimension; ++i) {
-            int r = a.at(i, k);
-            for (int j = 0; j < dimension; ++j) {
-                c.at(i, j) += r * b.at(k, j);
+__attribute__((target("avx2"))) static void add_avx2(const int* a,
+                                                     const int* b, int* c,
+                                                     int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(c + i), _mm256_add_epi32(x, y));
+    }
+    for (; i < n; ++i) c[i] = wrap_add(a[i], b[i]);
+}
+
+__attribute__((target("avx2"))) static void sub_avx2(const int* a,
+                                                     const int* b, int* c,
+                                                     int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(c + i), _mm256_sub_epi32(x, y));
+    }
+    for (; i < n; ++i) c[i] = wrap_sub(a[i], b[i]);
+}
+
+__attribute__((target("avx2"))) static void axpy_avx2(const int* b, int s,
+                                                      int* c, int n) {
+    __m256i r = _mm256_set1_epi32(s);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(c + i));
+        _mm256_storeu_si256((__m256i*)(c + i),
+                            _mm256_add_epi32(y, _mm256_mullo_epi32(r, x)));
+    }
+    for (; i < n; ++i) c[i] = wrap_add(c[i], wrap_mul(s, b[i]));
+}
+
+__attribute__((target("avx2"))) static int dot_avx2(const int* a,
+                                                    const int* b, int n) {
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(x, y));
+    }
+
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                 _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+
+    int dot = _mm_cvtsi128_si32(half);
+    for (; i < n; ++i) dot = wrap_add(dot, wrap_mul(a[i], b[i]));
+    return dot;
+}
+
+// Every product is two vectors, four columns keep eight accumulators
+__attribute__((target("avx2"))) static void batch_avx2(const int* a,
+                                                       const int* b, int* c,
+                                                       int n) {
+    constexpr int lanes = batch_lanes, block = 4;
+    for (int i = 0; i < n; ++i) {
+        int j = 0;
+        for (; j + block <= n; j += block) {
+            __m256i acc[block][2];
+            for (auto& column : acc) {
+                column[0] = column[1] = _mm256_setzero_si256();
+            }
+            for (int k = 0; k < n; ++k) {
+                const int* x = a + (size_t(i) * n + k) * lanes;
+                const int* y = b + (size_t(k) * n + j) * lanes;
+                __m256i x0 = _mm256_loadu_si256((const __m256i*)x);
+                __m256i x1 = _mm256_loadu_si256((const __m256i*)(x + 8));
+                for (int t = 0; t < block; ++t) {
+                    const __m256i* yt = (const __m256i*)(y + t * lanes);
+                    acc[t][0] = _mm256_add_epi32(
+                        acc[t][0],
+                        _mm256_mullo_epi32(x0, _mm256_loadu_si256(yt)));
+                    acc[t][1] = _mm256_add_epi32(
+                        acc[t][1],
+                        _mm256_mullo_epi32(x1, _mm256_loadu_si256(yt + 1)));
+                }
+            }
+            for (int t = 0; t < block; ++t) {
+                __m256i* out = (__m256i*)(c + (size_t(i) * n + j + t) * lanes);
+                _mm256_storeu_si256(out, acc[t][0]);
+                _mm256_storeu_si256(out + 1, acc[t][1]);
             }
         }
+        for (; j < n; ++j) {
+            __m256i acc0 = _mm256_setzero_si256(), acc1 = acc0;
+            for (int k = 0; k < n; ++k) {
+                const int* x = a + (size_t(i) * n + k) * lanes;
+                const int* y = b + (size_t(k) * n + j) * lanes;
+                acc0 = _mm256_add_epi32(
+                    acc0, _mm256_mullo_epi32(
+                              _mm256_loadu_si256((const __m256i*)x),
+                              _mm256_loadu_si256((const __m256i*)y)));
+                acc1 = _mm256_add_epi32(
+                    acc1, _mm256_mullo_epi32(
+                              _mm256_loadu_si256((const __m256i*)(x + 8)),
+                              _mm256_loadu_si256((const __m256i*)(y + 8))));
+            }
+            __m256i* out = (__m256i*)(c + (size_t(i) * n + j) * lanes);
+            _mm256_storeu_si256(out, acc0);
+            _mm256_storeu_si256(out + 1, acc1);
+        }
     }
 }
 
-void strassen_mul(submatrix a, submatrix b, submatrix c,
-                  submatrix scratch_space, int cutoff) {
-    int dimension = c.dimension;
-    a.dimension = dimension;
-    b.dimension = dimension;
+// 6x16 tile: 12 accumulators, 2 B vectors and a broadcast fit the 16 ymm
+//  registers
+__attribute__((target("avx2"))) static void micro_avx2(int kc, const int* pa,
+                                                       const int* pb, int* c,
+                                                       int ldc, int rows,
+                                                       int cols) {
+    constexpr int mr = 6, nr = 16;
+    __m256i acc[mr][2];
+#pragma GCC unroll 6
+    for (int x = 0; x < mr; ++x) {
+        acc[x][0] = _mm256_setzero_si256();
+        acc[x][1] = _mm256_setzero_si256();
+    }
 
-    std::function<void(submatrix, submatrix, submatrix, submatrix)>
-        strassen_mul_recursion;
-    strassen_mul_recursion = [&](submatrix A, submatrix B, submatrix C,
-                                 submatrix S) {
-        // Clear result
-        C.clear();
+    for (int k = 0; k < kc; ++k) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)pb);
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(pb + 8));
+#pragma GCC unroll 6
+        for (int x = 0; x < mr; ++x) {
+            __m256i r = _mm256_set1_epi32(pa[x]);
+            acc[x][0] = _mm256_add_epi32(acc[x][0], _mm256_mullo_epi32(r, b0));
+            acc[x][1] = _mm256_add_epi32(acc[x][1], _mm256_mullo_epi32(r, b1));
+        }
+        pa += mr;
+        pb += nr;
+    }
 
-        if (C.dimension % 2 == 1 || C.dimension <= cutoff) {
-            linear_mul(A, B, C);
-            return;
+    if (rows == mr && cols == nr) {
+#pragma GCC unroll 6
+        for (int x = 0; x < mr; ++x) {
+            __m256i* cr = (__m256i*)(c + x * ldc);
+            __m256i c0 = _mm256_loadu_si256(cr);
+            _mm256_storeu_si256(cr, _mm256_add_epi32(c0, acc[x][0]));
+            __m256i c1 = _mm256_loadu_si256(cr + 1);
+            _mm256_storeu_si256(cr + 1, _mm256_add_epi32(c1, acc[x][1]));
         }
+        return;
+    }
 
-        submatrix A00 = A.sub(0, 0);
-        submatrix A01 = A.sub(0, 1);
-        submatrix A10 = A.sub(1, 0);
-        submatrix A11 = A.sub(1, 1);
+    alignas(32) int tile[mr][nr];
+    for (int x = 0; x < mr; ++x) {
+        _mm256_store_si256((__m256i*)tile[x], acc[x][0]);
+        _mm256_store_si256((__m256i*)(tile[x] + 8), acc[x][1]);
+    }
+    for (int x = 0; x < rows; ++x) {
+        for (int y = 0; y < cols; ++y) {
+            c[x * ldc + y] = wrap_add(c[x * ldc + y], tile[x][y]);
+        }
+    }
+}
 
-        submatrix B00 = B.sub(0, 0);
-        submatrix B01 = B.sub(0, 1);
-        submatrix B10 = B.sub(1, 0);
-        submatrix B11 = B.sub(1, 1);
+__attribute__((target("avx512f"))) static void add_avx512(const int* a,
+                                                          const int* b, int* c,
+                                                          int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i x = _mm512_loadu_si512(a + i);
+        __m512i y = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(c + i, _mm512_add_epi32(x, y));
+    }
+    if (i < n) {
+        __mmask16 m = __mmask16((1u << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi32(m, a + i);
+        __m512i y = _mm512_maskz_loadu_epi32(m, b + i);
+        _mm512_mask_storeu_epi32(c + i, m, _mm512_add_epi32(x, y));
+    }
+}
 
-        submatrix C00 = C.sub(0, 0);
-        submatrix C01 = C.sub(0, 1);
-        submatrix C10 = C.sub(1, 0);
-        submatrix C11 = C.sub(1, 1);
+__attribute__((target("avx512f"))) static void sub_avx512(const int* a,
+                                                          const int* b, int* c,
+                                                          int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i x = _mm512_loadu_si512(a + i);
+        __m512i y = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(c + i, _mm512_sub_epi32(x, y));
+    }
+    if (i < n) {
+        __mmask16 m = __mmask16((1u << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi32(m, a + i);
+        __m512i y = _mm512_maskz_loadu_epi32(m, b + i);
+        _mm512_mask_storeu_epi32(c + i, m, _mm512_sub_epi32(x, y));
+    }
+}
 
-        // Storage space for product
-        submatrix M = S.sub(0, 0);
+__attribute__((target("avx512f"))) static void axpy_avx512(const int* b,
+                                                           int s, int* c,
+                                                           int n) {
+    __m512i r = _mm512_set1_epi32(s);
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? __mmask16(0xffff)
+                                  : __mmask16((1u << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi32(m, b + i);
+        __m512i y = _mm512_maskz_loadu_epi32(m, c + i);
+        _mm512_mask_storeu_epi32(c + i, m,
+                                 _mm512_add_epi32(y, _mm512_mullo_epi32(r, x)));
+    }
+}
 
-        // Recusrive scratch space
-        submatrix SR = S.sub(0, 1);
+__attribute__((target("avx512f"))) static int dot_avx512(const int* a,
+                                                         const int* b, int n) {
+    __m512i acc = _mm512_setzero_si512();
+    for (int i = 0; i < n; i += 16) {
+        __mmask16 m = n - i >= 16 ? __mmask16(0xffff)
+                                  : __mmask16((1u << (n - i)) - 1);
+        __m512i x = _mm512_maskz_loadu_epi32(m, a + i);
+        __m512i y = _mm512_maskz_loadu_epi32(m, b + i);
+        acc = _mm512_add_epi32(acc, _mm512_mullo_epi32(x, y));
+    }
 
-        // Storage for sums
-        submatrix sum0 = S.sub(1, 0);
-        submatrix sum1 = S.sub(1, 1);
+    // Zero masked lane swaps instead of '_mm512_reduce_add_epi32': the
+    //  unmasked forms, casts included, pass an undefined vector which GCC 12
+    //  reports under -Wuninitialized
+    const __mmask8 all = 0xff;
+    const __mmask16 every = 0xffff;
+    acc = _mm512_add_epi32(acc,
+                           _mm512_maskz_shuffle_i64x2(all, acc, acc, 0x4e));
+    acc = _mm512_add_epi32(acc,
+                           _mm512_maskz_shuffle_i64x2(all, acc, acc, 0xb1));
+    acc = _mm512_add_epi32(
+        acc, _mm512_maskz_shuffle_epi32(every, acc, _MM_PERM_BADC));
+    acc = _mm512_add_epi32(
+        acc, _mm512_maskz_shuffle_epi32(every, acc, _MM_PERM_CDAB));
+    return _mm512_cvtsi512_si32(acc);
+}
 
-        // Calculate M1
-        sum(A00, A11, sum0);
-        sum(B00, B11, sum1);
-        strassen_mul_recursion(sum0, sum1, M, SR);
-        sum(C00, M, C00);
-        sum(C11, M, C11);
+// Every product is one vector, 4x4 entries of C keep 16 accumulators so each
+//  loaded entry of A and B feeds four multiplies
+template <int R, int C>
+__attribute__((target("avx512f"))) static inline void batch_tile_avx512(
+    const int* a, const int* b, int* c, int n, int i, int j) {
+    constexpr int lanes = batch_lanes;
+    __m512i acc[R][C];
+    for (auto& row : acc) {
+        for (__m512i& v : row) v = _mm512_setzero_si512();
+    }
 
-        // Calculate M2
-        sum(A10, A11, sum0);
-        strassen_mul_recursion(sum0, B00, M, SR);
-        sum(C10, M, C10);
-        sub(C11, M, C11);
+    for (int k = 0; k < n; ++k) {
+        __m512i y[C];
+        for (int t = 0; t < C; ++t) {
+            y[t] = _mm512_loadu_si512(b + (size_t(k) * n + j + t) * lanes);
+        }
+        for (int r = 0; r < R; ++r) {
+            __m512i x = _mm512_loadu_si512(a + (size_t(i + r) * n + k) * lanes);
+            for (int t = 0; t < C; ++t) {
+                acc[r][t] =
+                    _mm512_add_epi32(acc[r][t], _mm512_mullo_epi32(x, y[t]));
+            }
+        }
+    }
 
-        // Calculate M3
-        sub(B01, B11, sum0);
-        strassen_mul_recursion(A00, sum0, M, SR);
-        sum(C01, M, C01);
-        sum(C11, M, C11);
+    for (int r = 0; r < R; ++r) {
+        for (int t = 0; t < C; ++t) {
+            _mm512_storeu_si512(c + (size_t(i + r) * n + j + t) * lanes,
+                                acc[r][t]);
+        }
+    }
+}
 
-        // Calculate M4
-        sub(B10, B00, sum0);
-        strassen_mul_recursion(A11, sum0, M, SR);
-        sum(C00, M, C00);
-        sum(C10, M, C10);
+template <int R>
+__attribute__((target("avx512f"))) static inline void batch_rows_avx512(
+    const int* a, const int* b, int* c, int n, int i) {
+    int j = 0;
+    for (; j + 4 <= n; j += 4) batch_tile_avx512<R, 4>(a, b, c, n, i, j);
+    for (; j < n; ++j) batch_tile_avx512<R, 1>(a, b, c, n, i, j);
+}
 
-        // Calculate M5
-        sum(A00, A01, sum0);
-        strassen_mul_recursion(sum0, B11, M, SR);
-        sub(C00, M, C00);
-        sum(C01, M, C01);
+__attribute__((target("avx512f"))) static void batch_avx512(const int* a,
+                                                            const int* b,
+                                                            int* c, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) batch_rows_avx512<4>(a, b, c, n, i);
+    for (; i < n; ++i) batch_rows_avx512<1>(a, b, c, n, i);
+}
 
-        // Caclulate M6
-        sub(A10, A00, sum0);
-        sum(B00, B01, sum1);
-        strassen_mul_recursion(sum0, sum1, M, SR);
-        sum(C11, M, C11);
+// 8x32 tile: 16 accumulators out of the 32 zmm registers, partial tiles are
+//  handled with masked loads/stores instead of a bounce buffer
+__attribute__((target("avx512f"))) static void micro_avx512(
+    int kc, const int* pa, const int* pb, int* c, int ldc, int rows,
+    int cols) {
+    constexpr int mr = 8, nr = 32;
+    __m512i acc[mr][2];
+#pragma GCC unroll 8
+    for (int x = 0; x < mr; ++x) {
+        acc[x][0] = _mm512_setzero_si512();
+        acc[x][1] = _mm512_setzero_si512();
+    }
 
-        // Calculate M7
-        sub(A01, A11, sum0);
-        sum(B10, B11, sum1);
-        strassen_mul_recursion(sum0, sum1, M, SR);
-        sum(C00, M, C00);
-    };
+    for (int k = 0; k < kc; ++k) {
+        __m512i b0 = _mm512_loadu_si512(pb);
+        __m512i b1 = _mm512_loadu_si512(pb + 16);
+#pragma GCC unroll 8
+        for (int x = 0; x < mr; ++x) {
+            __m512i r = _mm512_set1_epi32(pa[x]);
+            acc[x][0] = _mm512_add_epi32(acc[x][0], _mm512_mullo_epi32(r, b0));
+            acc[x][1] = _mm512_add_epi32(acc[x][1], _mm512_mullo_epi32(r, b1));
+        }
+        pa += mr;
+        pb += nr;
+    }
 
-    strassen_mul_recursion(a, b, c, scratch_space);
+    int lo = std::min(cols, 16), hi = std::max(cols - 16, 0);
+    __mmask16 m0 = __mmask16((1u << lo) - 1);
+    __mmask16 m1 = __mmask16((1u << hi) - 1);
+    for (int x = 0; x < rows; ++x) {
+        int* cr = c + x * ldc;
+        __m512i c0 = _mm512_maskz_loadu_epi32(m0, cr);
+        __m512i c1 = _mm512_maskz_loadu_epi32(m1, cr + 16);
+        _mm512_mask_storeu_epi32(cr, m0, _mm512_add_epi32(c0, acc[x][0]));
+        _mm512_mask_storeu_epi32(cr + 16, m1, _mm512_add_epi32(c1, acc[x][1]));
+    }
 }
+#endif
 
-int main(int argc, const char** argv) {
-    std::vector<std::string> args(argv + 1, argv + argc);
+#if defined(__aarch64__)
+#include <arm_neon.h>
 
-    if (argc != 4) return usage();
+static void add_neon(const int* a, const int* b, int* c, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_s32(c + i, vaddq_s32(vld1q_s32(a + i), vld1q_s32(b + i)));
+    }
+    for (; i < n; ++i) c[i] = wrap_add(a[i], b[i]);
+}
 
-    // Parse input parameters
-    int debug = to_int(args.at(0));
-    int dimension = to_int(args.at(1));
-    int cutoff = 32;
+static void sub_neon(const int* a, const int* b, int* c, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_s32(c + i, vsubq_s32(vld1q_s32(a + i), vld1q_s32(b + i)));
+    }
+    for (; i < n; ++i) c[i] = wrap_sub(a[i], b[i]);
+}
 
-    if (dimension <= 0) return usage();
+static void axpy_neon(const int* b, int s, int* c, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_s32(c + i, vmlaq_n_s32(vld1q_s32(c + i), vld1q_s32(b + i), s));
+    }
+    for (; i < n; ++i) c[i] = wrap_add(c[i], wrap_mul(s, b[i]));
+}
 
-    // Allocate input matrices
-    matrix_data a(dimension);
-    matrix_data b(dimension);
+static int dot_neon(const int* a, const int* b, int n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = vmlaq_s32(acc, vld1q_s32(a + i), vld1q_s32(b + i));
+    }
 
-    if ((debug & debug_flags::RANDOM) != 0) {
-        // Randomly populate matrices instead of reading from file
-        srand(time(NULL));
-        for (int i = 0; i < dimension * dimension; ++i) {
-            a.at(i) = rand() % 2;
-            b.at(i) = rand() % 2;
+    int dot = vaddvq_s32(acc);
+    for (; i < n; ++i) dot = wrap_add(dot, wrap_mul(a[i], b[i]));
+    return dot;
+}
+
+// Every product is four vectors, two columns keep eight accumulators
+static void batch_neon(const int* a, const int* b, int* c, int n) {
+    constexpr int lanes = batch_lanes, block = 2;
+    for (int i = 0; i < n; ++i) {
+        int j = 0;
+        for (; j + block <= n; j += block) {
+            int32x4_t acc[block][4];
+            for (auto& column : acc) {
+                for (int32x4_t& v : column) v = vdupq_n_s32(0);
+            }
+            for (int k = 0; k < n; ++k) {
+                const int* x = a + (size_t(i) * n + k) * lanes;
+                const int* y = b + (size_t(k) * n + j) * lanes;
+                for (int v = 0; v < 4; ++v) {
+                    int32x4_t xv = vld1q_s32(x + 4 * v);
+                    for (int t = 0; t < block; ++t) {
+                        acc[t][v] = vmlaq_s32(acc[t][v], xv,
+                                              vld1q_s32(y + t * lanes + 4 * v));
+                    }
+                }
+            }
+            for (int t = 0; t < block; ++t) {
+                int* out = c + (size_t(i) * n + j + t) * lanes;
+                for (int v = 0; v < 4; ++v) vst1q_s32(out + 4 * v, acc[t][v]);
+            }
         }
-        cutoff = std::max(to_int(args.at(2)), 1);
-    } else {
-        // Read data from file
-        std::string line;
-        std::ifstream file(args.at(2));
-
-        if (file.is_open()) {
-            int i = 0;
-            while (getline(file, line)) {
-                if (i < dimension * dimension) {
-                    a.at(i) = to_int(line);
-                } else {
-                    b.at(i - dimension * dimension) = to_int(line);
+        for (; j < n; ++j) {
+            int32x4_t acc[4];
+            for (int32x4_t& v : acc) v = vdupq_n_s32(0);
+            for (int k = 0; k < n; ++k) {
+                const int* x = a + (size_t(i) * n + k) * lanes;
+                const int* y = b + (size_t(k) * n + j) * lanes;
+                for (int v = 0; v < 4; ++v) {
+                    acc[v] = vmlaq_s32(acc[v], vld1q_s32(x + 4 * v),
+                                       vld1q_s32(y + 4 * v));
                 }
-                ++i;
             }
-            file.close();
-        } else {
-            // Error handling
-            std::cerr << "      Unable to open file: \"" << args.at(2) << "\""
-                      << std::endl;
-            return -1;
+            int* out = c + (size_t(i) * n + j) * lanes;
+            for (int v = 0; v < 4; ++v) vst1q_s32(out + 4 * v, acc[v]);
         }
     }
+}
 
-    matrix_data c_padded(padding_size(dimension, cutoff));
-    matrix_data scratch_space(c_padded.dimension);
-    submatrix c(c_padded);
-    c.dimension = dimension;
-
-    // Perform the multiplications
-    auto task = [&]() { strassen_mul(a, b, c_padded, scratch_space, cutoff); };
-    if ((debug & debug_flags::TIME) != 0) {
-        std::cout << "strassen: ";
-        time(task);
-    } else {
-        task();
+// 8x8 tile: 16 accumulators, the A column is loaded as two vectors and
+//  broadcast lane by lane through the multiply-accumulate
+static void micro_neon(int kc, const int* pa, const int* pb, int* c, int ldc,
+                       int rows, int cols) {
+    constexpr int mr = 8, nr = 8;
+    int32x4_t acc[mr][2];
+    for (int x = 0; x < mr; ++x) {
+        acc[x][0] = vdupq_n_s32(0);
+        acc[x][1] = vdupq_n_s32(0);
     }
 
-    if ((debug & debug_flags::PRINT) != 0) {
-        std::cout << "A:\n" << a;
-        std::cout << "B:\n" << b;
-        std::cout << "C:\n" << c_padded;
+    for (int k = 0; k < kc; ++k) {
+        int32x4_t b0 = vld1q_s32(pb);
+        int32x4_t b1 = vld1q_s32(pb + 4);
+        int32x4_t a0 = vld1q_s32(pa);
+        int32x4_t a1 = vld1q_s32(pa + 4);
+        acc[0][0] = vmlaq_laneq_s32(acc[0][0], b0, a0, 0);
+        acc[0][1] = vmlaq_laneq_s32(acc[0][1], b1, a0, 0);
+        acc[1][0] = vmlaq_laneq_s32(acc[1][0], b0, a0, 1);
+        acc[1][1] = vmlaq_laneq_s32(acc[1][1], b1, a0, 1);
+        acc[2][0] = vmlaq_laneq_s32(acc[2][0], b0, a0, 2);
+        acc[2][1] = vmlaq_laneq_s32(acc[2][1], b1, a0, 2);
+        acc[3][0] = vmlaq_laneq_s32(acc[3][0], b0, a0, 3);
+        acc[3][1] = vmlaq_laneq_s32(acc[3][1], b1, a0, 3);
+        acc[4][0] = vmlaq_laneq_s32(acc[4][0], b0, a1, 0);
+        acc[4][1] = vmlaq_laneq_s32(acc[4][1], b1, a1, 0);
+        acc[5][0] = vmlaq_laneq_s32(acc[5][0], b0, a1, 1);
+        acc[5][1] = vmlaq_laneq_s32(acc[5][1], b1, a1, 1);
+        acc[6][0] = vmlaq_laneq_s32(acc[6][0], b0, a1, 2);
+        acc[6][1] = vmlaq_laneq_s32(acc[6][1], b1, a1, 2);
+        acc[7][0] = vmlaq_laneq_s32(acc[7][0], b0, a1, 3);
+        acc[7][1] = vmlaq_laneq_s32(acc[7][1], b1, a1, 3);
+        pa += mr;
+        pb += nr;
     }
 
-    if ((debug & debug_flags::VERIFY) != 0) {
-        matrix_data check(dimension);
-
-        auto task = [&]() { linear_mul(a, b, check); };
-        if ((debug & debug_flags::TIME) != 0) {
-            std::cout << "linear: ";
-            time(task);
-        } else {
-            task();
+    if (rows == mr && cols == nr) {
+        for (int x = 0; x < mr; ++x) {
+            int* cr = c + x * ldc;
+            vst1q_s32(cr, vaddq_s32(vld1q_s32(cr), acc[x][0]));
+            vst1q_s32(cr + 4, vaddq_s32(vld1q_s32(cr + 4), acc[x][1]));
         }
+        return;
+    }
 
-        if ((debug & debug_flags::PRINT) != 0) {
-            std::cout << "check:\n" << check;
+    int tile[mr][nr];
+    for (int x = 0; x < mr; ++x) {
+        vst1q_s32(tile[x], acc[x][0]);
+        vst1q_s32(tile[x] + 4, acc[x][1]);
+    }
+    for (int x = 0; x < rows; ++x) {
+        for (int y = 0; y < cols; ++y) {
+            c[x * ldc + y] = wrap_add(c[x * ldc + y], tile[x][y]);
+        }
+    }
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+// The wider instruction sets for element types without hand written kernels
+//  are the portable kernels compiled for the target, AVX512DQ brings the
+//  64 bit multiplies. The register tiles keep 16 vector accumulators
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) static void micro_avx512_any(
+    int kc, const T* pa, const T* pb, T* c, int ldc, int rows, int cols) {
+    micro_scalar<T, 8, 128 / sizeof(T)>(kc, pa, pb, c, ldc, rows, cols);
+}
+
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) static void add_avx512_any(
+    const T* a, const T* b, T* c, int n) {
+    add_scalar(a, b, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) static void sub_avx512_any(
+    const T* a, const T* b, T* c, int n) {
+    sub_scalar(a, b, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) static void axpy_avx512_any(
+    const T* b, T s, T* c, int n) {
+    axpy_scalar(b, s, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) static T dot_avx512_any(
+    const T* a, const T* b, int n) {
+    return dot_scalar(a, b, n);
+}
+
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) static void batch_avx512_any(
+    const T* a, const T* b, T* c, int n) {
+    batch_scalar(a, b, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) static void micro_avx2_any(
+    int kc, const T* pa, const T* pb, T* c, int ldc, int rows, int cols) {
+    micro_scalar<T, 6, 64 / sizeof(T)>(kc, pa, pb, c, ldc, rows, cols);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) static void add_avx2_any(const T* a,
+                                                             const T* b, T* c,
+                                                             int n) {
+    add_scalar(a, b, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) static void sub_avx2_any(const T* a,
+                                                             const T* b, T* c,
+                                                             int n) {
+    sub_scalar(a, b, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) static void axpy_avx2_any(const T* b, T s,
+                                                              T* c, int n) {
+    axpy_scalar(b, s, c, n);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) static T dot_avx2_any(const T* a,
+                                                          const T* b, int n) {
+    return dot_scalar(a, b, n);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) static void batch_avx2_any(const T* a,
+                                                               const T* b,
+                                                               T* c, int n) {
+    batch_scalar(a, b, c, n);
+}
+#endif
+
+// Kernel sets of element type 'T', widest first
+template <typename T>
+static std::vector<kernel_set<T>> kernel_sets() {
+    return {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx512", 8, 128 / int(sizeof(T)), micro_avx512_any<T>,
+         add_avx512_any<T>, sub_avx512_any<T>, axpy_avx512_any<T>,
+         dot_avx512_any<T>, batch_avx512_any<T>},
+        {"avx2", 6, 64 / int(sizeof(T)), micro_avx2_any<T>, add_avx2_any<T>,
+         sub_avx2_any<T>, axpy_avx2_any<T>, dot_avx2_any<T>,
+         batch_avx2_any<T>},
+#endif
+        {"scalar", 4, 8, micro_scalar<T>, add_scalar<T>, sub_scalar<T>,
+         axpy_scalar<T>, dot_scalar<T>, batch_scalar<T>},
+    };
+}
+
+// 32 bit integers, the adjacency and counting workloads, have hand written
+//  kernels
+template <>
+std::vector<kernel_set<int>> kernel_sets<int>() {
+    return {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx512", 8, 32, micro_avx512, add_avx512, sub_avx512, axpy_avx512,
+         dot_avx512, batch_avx512},
+        {"avx2", 6, 16, micro_avx2, add_avx2, sub_avx2, axpy_avx2, dot_avx2,
+         batch_avx2},
+#endif
+#if defined(__aarch64__)
+        {"neon", 8, 8, micro_neon, add_neon, sub_neon, axpy_neon, dot_neon,
+         batch_neon},
+#endif
+        {"scalar", 4, 8, micro_scalar<int>, add_scalar<int>, sub_scalar<int>,
+         axpy_scalar<int>, dot_scalar<int>, batch_scalar<int>},
+    };
+}
+
+template <typename T>
+static bool kernel_supported(const kernel_set<T>& set) {
+    std::string name = set.name;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (name == "avx512") {
+        return __builtin_cpu_supports("avx512f") &&
+               (std::is_same<T, int>::value ||
+                __builtin_cpu_supports("avx512dq"));
+    }
+    if (name == "avx2") {
+        return __builtin_cpu_supports("avx2") &&
+               (std::is_same<T, int>::value || __builtin_cpu_supports("fma"));
+    }
+#endif
+    // NEON is part of the aarch64 baseline
+    return true;
+}
+
+template <typename T>
+static kernel_set<T> select_kernels() {
+    std::vector<kernel_set<T>> sets = kernel_sets<T>();
+    const char* forced = std::getenv("STRASSEN_KERNEL");
+    for (const kernel_set<T>& set : sets) {
+        if (forced != nullptr && std::string(forced) != set.name) continue;
+        if (kernel_supported(set)) return set;
+    }
+
+    // Reported once, for the 32 bit integer sets which have every name
+    if (forced != nullptr && std::is_same<T, int>::value) {
+        std::cerr << "      Unsupported kernel: \"" << forced << "\"\n";
+    }
+    return sets.back();
+}
+
+template <typename T>
+static const kernel_set<T> kernels = select_kernels<T>();
+
+// Recursion instrumentation, compiled in with '-DSTRASSEN_STATS'
+//  per level counters of the time spent in the add/sub row kernels, the leaf
+//  products and the peeling of odd levels, plus the leaf call and operation
+//  counts, the bytes the kernels touch and the padding entries that went
+//  through the checked 'get()' path, times are summed over the threads.
+//  Without the define every hook below is an empty inline function
+struct level_stats {
+    std::atomic<uint64_t> calls{0}, leaves{0}, leaf_ops{0};
+    std::atomic<uint64_t> add_ns{0}, leaf_ns{0}, peel_ns{0};
+    std::atomic<uint64_t> add_bytes{0}, leaf_bytes{0}, padding{0};
+};
+
+// Hardware counter hooks around every timed region, e.g. 'PAPI_start' and
+//  'PAPI_accum' or the perf_event enable/disable ioctls. 'region' is "add",
+//  "leaf" or "peel", 'depth' the recursion level
+struct stats_hooks {
+    void (*begin)(const char* region, int depth) = nullptr;
+    void (*end)(const char* region, int depth) = nullptr;
+};
+
+using stats_counter = std::atomic<uint64_t> level_stats::*;
+
+#ifdef STRASSEN_STATS
+static constexpr int stats_levels = 32;
+static level_stats strassen_stats[stats_levels];
+static stats_hooks strassen_hooks;
+
+// Level of the recursion running on this thread, -1 outside of it
+static thread_local int stats_depth = -1;
+
+static void stats_add(stats_counter counter, uint64_t amount) {
+    if (stats_depth >= 0) (strassen_stats[stats_depth].*counter) += amount;
+}
+
+// Attributes everything on this thread to 'depth' until it goes out of scope
+class stats_scope {
+   public:
+    explicit stats_scope(int depth) : previous(stats_depth) {
+        stats_depth = std::min(depth, stats_levels - 1);
+    }
+    ~stats_scope() { stats_depth = previous; }
+
+   private:
+    int previous;
+};
+
+// Adds the nanoseconds of its lifetime to 'counter'
+class stats_timer {
+   public:
+    stats_timer(const char* region, stats_counter counter)
+        : region(region), counter(counter),
+          start(std::chrono::steady_clock::now()) {
+        if (strassen_hooks.begin != nullptr) {
+            strassen_hooks.begin(region, stats_depth);
+        }
+    }
+    ~stats_timer() {
+        std::chrono::nanoseconds ns = std::chrono::steady_clock::now() - start;
+        stats_add(counter, ns.count());
+        if (strassen_hooks.end != nullptr) {
+            strassen_hooks.end(region, stats_depth);
+        }
+    }
+
+   private:
+    const char* region;
+    stats_counter counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+static void reset_stats() {
+    for (level_stats& level : strassen_stats) {
+        for (stats_counter counter :
+             {&level_stats::calls, &level_stats::leaves, &level_stats::leaf_ops,
+              &level_stats::add_ns, &level_stats::leaf_ns,
+              &level_stats::peel_ns, &level_stats::add_bytes,
+              &level_stats::leaf_bytes, &level_stats::padding}) {
+            (level.*counter) = 0;
+        }
+    }
+}
+
+static void print_stats(std::ostream& os) {
+    os << "level calls leaves leaf_Gops add_ms leaf_ms peel_ms add_MB "
+          "leaf_MB padding\n";
+    for (int depth = 0; depth < stats_levels; ++depth) {
+        const level_stats& l = strassen_stats[depth];
+        if (l.calls == 0) continue;
+        os << depth << " " << l.calls << " " << l.leaves << " "
+           << l.leaf_ops * 1e-9 << " " << l.add_ns * 1e-6 << " "
+           << l.leaf_ns * 1e-6 << " " << l.peel_ns * 1e-6 << " "
+           << l.add_bytes / 1048576.0 << " " << l.leaf_bytes / 1048576.0
+           << " " << l.padding << "\n";
+    }
+}
+#else
+static inline void stats_add(stats_counter, uint64_t) {}
+
+class stats_scope {
+   public:
+    explicit stats_scope(int) {}
+};
+
+class stats_timer {
+   public:
+    stats_timer(const char*, stats_counter) {}
+};
+
+static inline void reset_stats() {}
+static inline void print_stats(std::ostream&) {}
+#endif
+
+// One leaf product of dimension 'n' which touches 'elements' entries
+template <typename T>
+static void stats_leaf(int n, size_t elements) {
+    stats_add(&level_stats::leaves, 1);
+    stats_add(&level_stats::leaf_ops, 2 * uint64_t(n) * n * n);
+    stats_add(&level_stats::leaf_bytes, elements * sizeof(T));
+}
+
+// Elementwise 'c = a op b', the bounds are checked once for the block: the
+//  region backed by all three operands runs through the vector row kernel and
+//  only the edge strips of 'c' fall back to the checked 'get()'
+template <typename T, typename Op>
+static void elementwise(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+                        void (*row_op)(const T*, const T*, T*, int), Op op) {
+    stats_timer timer("add", &level_stats::add_ns);
+
+    // Morton blocks of the same shape are one contiguous stream
+    if (c.blocked()) {
+        assert(a.blocked() && b.blocked() && a.tile == c.tile &&
+               b.tile == c.tile && a.dimension == c.dimension);
+        size_t n = c.dimension;
+        stats_add(&level_stats::add_bytes, 3 * n * n * sizeof(T));
+        for (size_t x = 0; x < n; ++x) {
+            row_op(a.data + x * n, b.data + x * n, c.data + x * n, int(n));
+        }
+        return;
+    }
+
+    int fast_rows = std::min({c.rows, a.rows, b.rows});
+    int fast_cols = std::min({c.cols, a.cols, b.cols});
+    size_t entries = size_t(c.rows) * c.cols;
+    stats_add(&level_stats::add_bytes, 3 * entries * sizeof(T));
+    stats_add(&level_stats::padding, entries - size_t(fast_rows) * fast_cols);
+
+    for (int x = 0; x < fast_rows; ++x) {
+        T* cr = c.row(x);
+        row_op(a.row(x), b.row(x), cr, fast_cols);
+        for (int y = fast_cols; y < c.cols; ++y) {
+            cr[y] = op(a.get(x, y), b.get(x, y));
+        }
+    }
+
+    for (int x = fast_rows; x < c.rows; ++x) {
+        for (int y = 0; y < c.cols; ++y) {
+            c.at(x, y) = op(a.get(x, y), b.get(x, y));
+        }
+    }
+}
+
+// Submatrix addition with data target
+//  assumes that 'c' is cleared
+template <typename T>
+void sum(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+    elementwise(a, b, c, kernels<T>.add, wrap_add<T>);
+}
+
+// Submatrix subtraction with data target
+//  assumes that 'c' is cleared
+template <typename T>
+void sub(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+    elementwise(a, b, c, kernels<T>.sub, wrap_sub<T>);
+}
+
+template <typename T>
+static void copy_row(const T* a, const T*, T* c, int n) {
+    std::copy(a, a + n, c);
+}
+
+// Submatrix copy 'c = a', the first contribution to a quadrant is assigned
+//  instead of accumulated into a cleared one
+template <typename T>
+void assign(matrix_view<T> a, matrix_view<T> c) {
+    elementwise(a, a, c, copy_row<T>, [](T x, T) { return x; });
+}
+
+// Leaf kernel blocking parameters: the micro kernel holds an 'mr' x 'nr'
+//  register tile, a 'gemm_kc' x 'nr' sliver of packed B stays in L1 and a
+//  'gemm_mc' x 'gemm_kc' block of packed A stays in L2
+static constexpr int gemm_kc = 256;
+static constexpr int gemm_mc = 64;
+static constexpr int gemm_nc = 1024;
+
+// Leaf GEMM operand 'x + sign * y' on raw row-major blocks, just 'x' when
+//  'sign' is zero. Sums are evaluated while packing, so they never hit memory
+template <typename T>
+struct leaf_operand {
+    const T* x;
+    const T* y;
+    int ldx, ldy;
+    int sign;
+
+    leaf_operand at(int row, int col) const {
+        leaf_operand o = *this;
+        o.x += ptrdiff_t(row) * ldx + col;
+        if (sign != 0) o.y += ptrdiff_t(row) * ldy + col;
+        return o;
+    }
+};
+
+// Leaf GEMM output 'c += sign * product'
+template <typename T>
+struct leaf_target {
+    T* c;
+    int ldc;
+    int sign;
+
+    // Overwrite instead of accumulate, 'c' doesn't need clearing
+    bool assign = false;
+};
+
+// Copies a 'kc' x 'nc' block of B into column panels of width 'nr', each
+//  stored k-major so the micro kernel streams through it, zero padded
+template <typename T>
+static void pack_b(leaf_operand<T> b, int kc, int nc, int nr, T* packed) {
+    for (int j = 0; j < nc; j += nr) {
+        int cols = std::min(nr, nc - j);
+        for (int k = 0; k < kc; ++k) {
+            const T* xr = b.x + ptrdiff_t(k) * b.ldx + j;
+            if (b.sign == 0) {
+                for (int y = 0; y < cols; ++y) packed[y] = xr[y];
+            } else {
+                const T* yr = b.y + ptrdiff_t(k) * b.ldy + j;
+                if (b.sign > 0) {
+                    for (int y = 0; y < cols; ++y) {
+                        packed[y] = wrap_add(xr[y], yr[y]);
+                    }
+                } else {
+                    for (int y = 0; y < cols; ++y) {
+                        packed[y] = wrap_sub(xr[y], yr[y]);
+                    }
+                }
+            }
+            for (int y = cols; y < nr; ++y) packed[y] = T(0);
+            packed += nr;
+        }
+    }
+}
+
+// Copies a 'mc' x 'kc' block of A into row panels of height 'mr', each stored
+//  k-major, zero padded
+template <typename T>
+static void pack_a(leaf_operand<T> a, int mc, int kc, int mr, T* packed) {
+    for (int i = 0; i < mc; i += mr) {
+        int rows = std::min(mr, mc - i);
+        for (int k = 0; k < kc; ++k) {
+            for (int x = 0; x < rows; ++x) {
+                ptrdiff_t row = i + x;
+                T value = a.x[row * a.ldx + k];
+                if (a.sign > 0) value = wrap_add(value, a.y[row * a.ldy + k]);
+                if (a.sign < 0) value = wrap_sub(value, a.y[row * a.ldy + k]);
+                packed[x] = value;
+            }
+            for (int x = rows; x < mr; ++x) packed[x] = T(0);
+            packed += mr;
+        }
+    }
+}
+
+// Cache blocked 'targets += a * b', 'a' is 'm' x 'k' and 'b' is 'k' x 'n'.
+//  A single unit target is accumulated by the micro kernel directly, several
+//  (or negated) targets go through a register tile sized bounce buffer.
+//  Assigned targets are zeroed tile by tile during the first 'kc' panel,
+//  right before the micro kernel touches them
+template <typename T>
+static void gemm_fused(leaf_operand<T> a, leaf_operand<T> b,
+                       const leaf_target<T>* targets, int count, int m, int n,
+                       int k) {
+    static thread_local std::vector<T> packed_a(gemm_mc * gemm_kc);
+    static thread_local std::vector<T> packed_b(gemm_kc * gemm_nc);
+    static thread_local std::vector<T> tile;
+
+    const int mr = kernels<T>.mr, nr = kernels<T>.nr;
+    const int mc_step = gemm_mc / mr * mr;
+    const bool direct = count == 1 && targets[0].sign == 1;
+    tile.resize(size_t(mr) * nr);
+
+    for (int jc = 0; jc < n; jc += gemm_nc) {
+        int nc = std::min(gemm_nc, n - jc);
+        for (int pc = 0; pc < k; pc += gemm_kc) {
+            int kc = std::min(gemm_kc, k - pc);
+            pack_b(b.at(pc, jc), kc, nc, nr, packed_b.data());
+
+            for (int ic = 0; ic < m; ic += mc_step) {
+                int mc = std::min(mc_step, m - ic);
+                pack_a(a.at(ic, pc), mc, kc, mr, packed_a.data());
+
+                for (int jr = 0; jr < nc; jr += nr) {
+                    const T* pb = packed_b.data() + jr * kc;
+                    int cols = std::min(nr, nc - jr);
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        const T* pa = packed_a.data() + ir * kc;
+                        int rows = std::min(mr, mc - ir);
+                        ptrdiff_t x0 = ic + ir, y0 = jc + jr;
+
+                        if (direct) {
+                            const leaf_target<T>& t = targets[0];
+                            T* ct = t.c + x0 * t.ldc + y0;
+                            if (t.assign && pc == 0) {
+                                for (int x = 0; x < rows; ++x) {
+                                    std::fill_n(ct + x * t.ldc, cols, T(0));
+                                }
+                            }
+                            kernels<T>.micro(kc, pa, pb, ct, t.ldc, rows,
+                                             cols);
+                            continue;
+                        }
+
+                        std::fill(tile.begin(), tile.end(), T(0));
+                        kernels<T>.micro(kc, pa, pb, tile.data(), nr, rows,
+                                         cols);
+                        for (int t = 0; t < count; ++t) {
+                            const leaf_target<T>& target = targets[t];
+                            for (int x = 0; x < rows; ++x) {
+                                T* cr = target.c + (x0 + x) * target.ldc + y0;
+                                if (target.assign && pc == 0) {
+                                    std::fill_n(cr, cols, T(0));
+                                }
+                                kernels<T>.axpy(tile.data() + x * nr,
+                                                T(target.sign), cr, cols);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Cache blocked 'c += a * b' on raw row-major blocks, 'a' is 'm' x 'k' and
+//  'b' is 'k' x 'n'
+template <typename T>
+static void gemm(const T* a, int lda, const T* b, int ldb, T* c, int ldc,
+                 int m, int n, int k) {
+    leaf_target<T> target{c, ldc, 1};
+    gemm_fused(leaf_operand<T>{a, nullptr, lda, 0, 0},
+               leaf_operand<T>{b, nullptr, ldb, 0, 0}, &target, 1, m, n, k);
+}
+
+// Accumulates 'a * b' into 'c'. Everything outside of the rows/columns backed
+//  by data is zero, so the product is simply clamped to the backed extents
+template <typename T>
+void linear_mul(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+    int rows = std::min(c.rows, a.rows);
+    int cols = std::min(c.cols, b.cols);
+    int inner = std::min({c.dimension, a.cols, b.rows});
+    if (rows == 0 || cols == 0 || inner == 0) return;
+
+    gemm(a.data, a.stride, b.data, b.stride, c.data, c.stride, rows, cols,
+         inner);
+}
+
+// Leaf 'c = a * b', the GEMM assigns the first panel so 'c' is only cleared
+//  if 'a' and 'b' don't back all of it
+template <typename T>
+static void leaf_mul(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+    int inner = std::min({c.dimension, a.cols, b.rows});
+    if (a.rows < c.rows || b.cols < c.cols || inner == 0) {
+        c.clear();
+        linear_mul(a, b, c);
+        return;
+    }
+
+    leaf_target<T> target{c.data, c.stride, 1, true};
+    gemm_fused(leaf_operand<T>{a.data, nullptr, a.stride, 0, 0},
+               leaf_operand<T>{b.data, nullptr, b.stride, 0, 0}, &target, 1,
+               c.rows, c.cols, inner);
+}
+
+// Pins the calling thread to 'cpu', best effort
+static void pin_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Work-stealing thread pool
+//  every worker owns a deque, it pushes and pops its own tasks at the back
+//  (depth first) while idle workers steal from the front of the others
+//  (breadth first). The thread which creates the pool acts as worker 0 and
+//  only runs tasks while it waits on a 'task_group'. With 'cpus' worker 'i'
+//  is pinned to 'cpus[i % cpus.size()]', worker 0 is the calling thread
+//  whose previous affinity the destructor restores, so the pool has to be
+//  destroyed on the thread which created it
+class thread_pool {
+   public:
+    explicit thread_pool(int threads, std::vector<int> cpus = {})
+        : cpus(std::move(cpus)) {
+        threads = std::max(threads, 1);
+        if (!this->cpus.empty()) {
+            CPU_ZERO(&caller_affinity);
+            pinned_caller =
+                pthread_getaffinity_np(pthread_self(), sizeof(caller_affinity),
+                                       &caller_affinity) == 0;
+            if (pinned_caller) pin_thread(this->cpus[0]);
+        }
+        for (int i = 0; i < threads; ++i) {
+            queues.emplace_back(new worker_queue());
+        }
+        for (int i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i]() { work(i); });
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        if (pinned_caller) {
+            pthread_setaffinity_np(pthread_self(), sizeof(caller_affinity),
+                                   &caller_affinity);
+        }
+    }
+
+    int size() const { return int(queues.size()); }
+
+    void push(std::function<void(void)> task) {
+        {
+            worker_queue& queue = *queues[index()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            pending++;
+        }
+        wake.notify_one();
+    }
+
+    // Runs one pending task, own queue first, returns false if there was none
+    bool run_one() {
+        std::function<void(void)> task;
+        int self = index();
+
+        for (int n = 0; n < size() && !task; ++n) {
+            worker_queue& queue = *queues[(self + n) % size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty()) continue;
+
+            if (n == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+
+        if (!task) return false;
+        pending--;
+        task();
+        return true;
+    }
+
+   private:
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<std::function<void(void)>> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> workers;
+    std::vector<int> cpus;
+    cpu_set_t caller_affinity;
+    bool pinned_caller = false;
+
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    std::atomic<int> pending{0};
+    bool stopping = false;
+
+    static thread_local const thread_pool* current_pool;
+    static thread_local int current_index;
+
+    int index() const { return current_pool == this ? current_index : 0; }
+
+    void work(int i) {
+        current_pool = this;
+        current_index = i;
+        if (!cpus.empty()) pin_thread(cpus[i % cpus.size()]);
+
+        while (true) {
+            if (run_one()) continue;
+
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            if (stopping) return;
+            wake.wait(guard, [this]() { return stopping || pending > 0; });
+        }
+    }
+};
+
+thread_local const thread_pool* thread_pool::current_pool = nullptr;
+thread_local int thread_pool::current_index = 0;
+
+// Fork-join scope on a pool, 'wait()' helps running tasks instead of blocking
+//  so nested groups can't deadlock the workers
+class task_group {
+   public:
+    explicit task_group(thread_pool& pool) : pool(pool) {}
+    ~task_group() { wait(); }
+
+    void run(std::function<void(void)> task) {
+        remaining++;
+        pool.push([this, task]() {
+            task();
+            remaining--;
+        });
+    }
+
+    void wait() {
+        while (remaining > 0) {
+            if (!pool.run_one()) std::this_thread::yield();
+        }
+    }
+
+   private:
+    thread_pool& pool;
+    std::atomic<int> remaining{0};
+};
+
+// NUMA placement
+//  with '--numa local' the big buffers (the operands, C, the Morton copies
+//  and the recursion scratch) are zeroed by all workers of the pool in
+//  parallel, so their pages are first touched on the nodes of the workers
+//  instead of all on the node of the main thread. '--numa interleave' also
+//  spreads them page by page over the nodes with 'mbind', which suits the
+//  work-stealing tasks that may run anywhere. Both pin the workers to CPUs
+//  scattered over the nodes in turn, so the seven top level tasks land on
+//  different sockets
+enum class numa_policy { none, local, interleave };
+
+static std::vector<int> parse_cpu_list(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream list(text);
+    for (std::string range; getline(list, range, ',');) {
+        size_t dash = range.find('-');
+        int first = to_int(range.substr(0, dash));
+        int last = dash == std::string::npos ? first
+                                             : to_int(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// The online nodes and the CPUs of each this process may run on, a single
+//  node with every allowed CPU if sysfs has no topology
+static std::map<int, std::vector<int>> numa_nodes() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    std::map<int, std::vector<int>> nodes;
+    std::string online;
+    std::ifstream file("/sys/devices/system/node/online");
+    getline(file, online);
+    for (int node : parse_cpu_list(online)) {
+        std::ifstream cpulist("/sys/devices/system/node/node" +
+                              std::to_string(node) + "/cpulist");
+        std::string text;
+        getline(cpulist, text);
+        for (int cpu : parse_cpu_list(text)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                nodes[node].push_back(cpu);
+            }
+        }
+    }
+
+    if (nodes.empty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) nodes[0].push_back(cpu);
+        }
+    }
+    return nodes;
+}
+
+// CPUs for the pool workers: the first CPU of every node, then the second
+//  of every node and so on
+static std::vector<int> scatter_cpus() {
+    std::map<int, std::vector<int>> nodes = numa_nodes();
+    std::vector<int> cpus;
+    for (size_t i = 0; cpus.size() < size_t(CPU_SETSIZE); ++i) {
+        size_t before = cpus.size();
+        for (auto& node : nodes) {
+            if (i < node.second.size()) cpus.push_back(node.second[i]);
+        }
+        if (cpus.size() == before) break;
+    }
+    return cpus;
+}
+
+// Interleaves the pages of 'memory' over all nodes with CPUs, best effort
+//  and only before the pages are first touched. 'memory' has to start a
+//  page of its own mapping, the policy never reaches neighbouring data
+static void interleave_pages(void* memory, size_t bytes) {
+    uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    std::map<int, std::vector<int>> nodes = numa_nodes();
+    if (nodes.size() < 2 || bytes == 0 || uintptr_t(memory) % page != 0) {
+        return;
+    }
+
+    unsigned long mask[16] = {};
+    for (auto& node : nodes) {
+        if (node.first < 16 * 64) {
+            mask[node.first / 64] |= 1UL << node.first % 64;
+        }
+    }
+
+    syscall(SYS_mbind, uintptr_t(memory), bytes, MPOL_INTERLEAVE, mask,
+            16 * 64, 0);
+}
+
+// Zero initialized storage of 'count' elements placed by 'policy'. With
+//  'touch' the workers of 'pool' touch it first in one contiguous chunk
+//  each, otherwise the pages land wherever the code using them writes first.
+//  Placed storage is always its own page aligned mapping, a heap block would
+//  already be touched by the allocating thread and share pages with others
+template <typename T>
+static std::shared_ptr<T> numa_allocate(size_t count, numa_policy policy,
+                                        thread_pool* pool, bool touch = true) {
+    if (policy == numa_policy::none || pool == nullptr || count == 0) {
+        return lazy_allocate<T>(count);
+    }
+    std::shared_ptr<T> storage = map_pages<T>(count);
+    if (!storage) return lazy_allocate<T>(count);
+
+    T* memory = storage.get();
+    if (policy == numa_policy::interleave) {
+        interleave_pages(memory, count * sizeof(T));
+    }
+    if (!touch) return storage;
+
+    size_t parts = size_t(pool->size());
+    size_t step = (count + parts - 1) / parts;
+    task_group fill(*pool);
+    for (size_t first = 0; first < count; first += step) {
+        fill.run([=]() {
+            std::fill(memory + first, memory + std::min(count, first + step),
+                      T(0));
+        });
+    }
+    fill.wait();
+    return storage;
+}
+
+// Square 'dimension' matrix on 'numa_allocate' storage
+template <typename T>
+static matrix_data<T> numa_matrix(int dimension, numa_policy policy,
+                                  thread_pool* pool, bool touch = true) {
+    std::shared_ptr<T> memory =
+        numa_allocate<T>(size_t(dimension) * dimension, policy, pool, touch);
+    return matrix_data<T>(dimension, memory.get(), memory);
+}
+
+// Reproducible random inputs
+//  entry 'i' of stream 's' is a pure function of '--seed', 's' and 'i', a
+//  splitmix64 finalizer over the counter, so any part of a matrix can be
+//  generated on its own and the pool fills the chunks in parallel with the
+//  same result for any thread count. A share '--density' of the entries is
+//  non-zero and those are integers drawn uniformly from '--range LO,HI',
+//  the defaults give the 0/1 matrices the recursion was tuned on
+struct random_spec {
+    uint64_t seed = 0;
+    int64_t low = 0;
+    int64_t high = 1;
+    double density = 1.0;
+};
+
+static inline uint64_t random_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t random_key(uint64_t seed, uint64_t stream) {
+    return random_mix(seed ^ random_mix(stream + 1));
+}
+
+static inline uint64_t random_bits(uint64_t key, uint64_t counter) {
+    return random_mix(key + counter * 0x9e3779b97f4a7c15ull);
+}
+
+// Uniform in [0, 1)
+static inline double random_unit(uint64_t bits) {
+    return double(bits >> 11) * 0x1.0p-53;
+}
+
+static bool parse_random(std::map<std::string, std::string>& options,
+                         random_spec& spec) {
+    spec.seed = uint64_t(time(NULL));
+    if (options.count("seed") != 0) {
+        std::stringstream text(options["seed"]);
+        if (!(text >> spec.seed)) return false;
+    }
+    if (options.count("range") != 0) {
+        std::stringstream text(options["range"]);
+        char comma = 0;
+        if (!(text >> spec.low >> comma >> spec.high) || comma != ',') {
+            return false;
+        }
+    }
+    if (options.count("density") != 0) {
+        std::stringstream text(options["density"]);
+        if (!(text >> spec.density)) return false;
+    }
+    return spec.low <= spec.high && spec.high - spec.low < (1ll << 32) &&
+           spec.density >= 0 && spec.density <= 1;
+}
+
+// Fills 'count' entries of 'data' with entries 'first' on of 'stream'
+//  the low half of the bits picks zero or non-zero, the high half the value
+template <typename T>
+static void random_span(T* data, size_t count, size_t first, uint64_t stream,
+                        const random_spec& spec) {
+    uint64_t key = random_key(spec.seed, stream);
+    uint64_t span = uint64_t(spec.high - spec.low) + 1;
+    uint64_t threshold = uint64_t(spec.density * 4294967296.0);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t bits = random_bits(key, first + i);
+        int64_t value = spec.low + int64_t(((bits >> 32) * span) >> 32);
+        data[i] = (bits & 0xffffffffull) < threshold ? T(value) : T(0);
+    }
+}
+
+// Fills all of 'm' from 'stream', in parallel chunks with a pool
+template <typename T>
+static void random_matrix(matrix_data<T>& m, uint64_t stream,
+                          const random_spec& spec, thread_pool* pool) {
+    size_t count = size_t(m.rows) * m.cols;
+    const size_t chunk = size_t(1) << 16;
+    if (count == 0) return;
+    if (pool == nullptr || count <= chunk) {
+        random_span(&m.at(0), count, 0, stream, spec);
+        return;
+    }
+
+    T* data = &m.at(0);
+    task_group fill(*pool);
+    for (size_t first = 0; first < count; first += chunk) {
+        fill.run([=, &spec]() {
+            random_span(data + first, std::min(chunk, count - first), first,
+                        stream, spec);
+        });
+    }
+    fill.wait();
+}
+
+// Smallest spawn depth which gives every thread a couple of products
+static int default_spawn_depth(int threads) {
+    int depth = 0;
+    for (int tasks = 1; tasks < 2 * threads; tasks *= 7) depth++;
+    return depth;
+}
+
+// Quadrant operands of the seven products, either used as is (a zero
+//  'sign') or as the sum (1) or difference (-1) of two quadrants
+struct strassen_operand {
+    int x, y;
+    int sign;
+    int u, v;
+};
+
+// Strassen products M1..M7 as 'lhs * rhs' over the quadrants of A and B
+static const strassen_operand strassen_lhs[7] = {
+    {0, 0, 1, 1, 1},   // A00 + A11
+    {1, 0, 1, 1, 1},   // A10 + A11
+    {0, 0, 0, 0, 0},   // A00
+    {1, 1, 0, 0, 0},   // A11
+    {0, 0, 1, 0, 1},   // A00 + A01
+    {1, 0, -1, 0, 0},  // A10 - A00
+    {0, 1, -1, 1, 1},  // A01 - A11
+};
+static const strassen_operand strassen_rhs[7] = {
+    {0, 0, 1, 1, 1},   // B00 + B11
+    {0, 0, 0, 0, 0},   // B00
+    {0, 1, -1, 1, 1},  // B01 - B11
+    {1, 0, -1, 0, 0},  // B10 - B00
+    {1, 1, 0, 0, 0},   // B11
+    {0, 0, 1, 0, 1},   // B00 + B01
+    {1, 0, 1, 1, 1},   // B10 + B11
+};
+
+// Quadrants of C that the products are accumulated into, with their signs,
+//  a zero sign marks an unused slot
+struct strassen_target {
+    int x, y, sign;
+};
+
+static const strassen_target strassen_targets[7][2] = {
+    {{0, 0, 1}, {1, 1, 1}},    // C00 += M1, C11 += M1
+    {{1, 0, 1}, {1, 1, -1}},   // C10 += M2, C11 -= M2
+    {{0, 1, 1}, {1, 1, 1}},    // C01 += M3, C11 += M3
+    {{0, 0, 1}, {1, 0, 1}},    // C00 += M4, C10 += M4
+    {{0, 0, -1}, {0, 1, 1}},   // C00 -= M5, C01 += M5
+    {{1, 1, 1}, {0, 0, 0}},    // C11 += M6
+    {{0, 0, 1}, {0, 0, 0}},    // C00 += M7
+};
+
+// Row-major leaf operand for one of the 'strassen_lhs'/'strassen_rhs' entries
+template <typename T>
+static leaf_operand<T> fused_operand(matrix_view<T> m,
+                                     const strassen_operand& o) {
+    matrix_view<T> x = m.sub(o.x, o.y);
+    if (o.sign == 0) return leaf_operand<T>{x.data, nullptr, x.stride, 0, 0};
+
+    matrix_view<T> y = m.sub(o.u, o.v);
+    return leaf_operand<T>{x.data, y.data, x.stride, y.stride, o.sign};
+}
+
+// Is every quadrant a fully backed row-major block the leaf kernel can read
+template <typename T>
+static bool fusable(matrix_view<T> m) {
+    return !m.sub(0, 0).blocked() && m.rows == m.dimension &&
+           m.cols == m.dimension && m.dimension % 2 == 0;
+}
+
+// Classic level whose children are leaves: the seven products run straight
+//  through the leaf kernel with the operand sums fused into its packing and
+//  the accumulation into the quadrants of 'c' fused into its store
+template <typename T>
+static void fused_strassen_leaves(matrix_view<T> a, matrix_view<T> b,
+                                  matrix_view<T> c) {
+    int half = c.dimension / 2;
+
+    // The first product into a quadrant assigns it, so 'c' needs no clearing
+    bool written[2][2] = {};
+    for (int p = 0; p < 7; ++p) {
+        leaf_target<T> targets[2];
+        int count = 0;
+        for (const strassen_target& t : strassen_targets[p]) {
+            if (t.sign == 0) continue;
+            matrix_view<T> q = c.sub(t.x, t.y);
+            targets[count++] = leaf_target<T>{q.data, q.stride, t.sign,
+                                              !written[t.x][t.y]};
+            written[t.x][t.y] = true;
+        }
+
+        int reads = 2 + (strassen_lhs[p].sign != 0) +
+                    (strassen_rhs[p].sign != 0);
+        stats_leaf<T>(half, (reads + 2 * count) * size_t(half) * half);
+        gemm_fused(fused_operand(a, strassen_lhs[p]),
+                   fused_operand(b, strassen_rhs[p]), targets, count, half,
+                   half, half);
+    }
+}
+
+// Dynamic peeling of an odd 'c = a * b': with 'e = dimension - 1' and the
+//  even core 'c[0:e, 0:e] = a[0:e, 0:e] * b[0:e, 0:e]' already computed,
+//  adds the rank-1 update 'a[0:e, e] * b[e, 0:e]' to the core and fills in
+//  the last row and column. 'column' holds 'dimension' elements to gather the
+//  last column of 'b' into
+template <typename T>
+static void peel_update(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+                        T* column) {
+    int e = c.dimension - 1;
+
+    // Rank-1 update of the core
+    const T* be = b.row(e);
+    for (int i = 0; i < e; ++i) kernels<T>.axpy(be, a.at(i, e), c.row(i), e);
+
+    // Last column, dot products of the rows of 'a' with the last column of 'b'
+    for (int k = 0; k <= e; ++k) column[k] = b.at(k, e);
+    for (int i = 0; i <= e; ++i) {
+        c.at(i, e) = kernels<T>.dot(a.row(i), column, e + 1);
+    }
+
+    // Last row without the corner, combination of the rows of 'b'
+    T* cr = c.row(e);
+    std::fill(cr, cr + e, T(0));
+    for (int k = 0; k <= e; ++k) kernels<T>.axpy(b.row(k), a.at(e, k), cr, e);
+}
+
+// Schedules of the seven multiplications: the classic Strassen one with 18
+//  additions, or the Strassen-Winograd one with 15
+enum class strassen_algorithm { classic, winograd };
+
+// Exact number of scratch elements 'strassen_mul' needs for 'dimension', the
+//  recursion is walked once and summed level by level
+size_t strassen_scratch_size(
+    int dimension, int cutoff, int spawn_depth = 0,
+    strassen_algorithm algorithm = strassen_algorithm::classic,
+    int depth = 0) {
+    if (dimension <= cutoff) return 0;
+
+    // Peeled level, a gathered column of B next to the even core
+    if (dimension % 2 == 1) {
+        return dimension + strassen_scratch_size(dimension - 1, cutoff,
+                                                 spawn_depth, algorithm, depth);
+    }
+
+    int half = dimension / 2;
+    size_t quadrant = size_t(half) * half;
+    size_t below = strassen_scratch_size(half, cutoff, spawn_depth, algorithm,
+                                         depth + 1);
+
+    if (depth >= spawn_depth) {
+        // Winograd keeps its products in C and only needs the two operand
+        //  temporaries, the classic schedule also needs the product
+        if (algorithm == strassen_algorithm::winograd) {
+            return 2 * quadrant + below;
+        }
+        return 3 * quadrant + below;
+    }
+
+    // Every task owns its product, operand sums and recursion scratch
+    size_t size = 0;
+    for (int p = 0; p < 7; ++p) {
+        int sums = (strassen_lhs[p].sign != 0) + (strassen_rhs[p].sign != 0);
+        size += (1 + sums) * quadrant + below;
+    }
+    return size;
+}
+
+#ifdef STRASSEN_OFFLOAD
+// GPU offload through OpenMP target regions, compiled in with
+//  '-fopenmp -DSTRASSEN_OFFLOAD' plus the offload target of the compiler
+//  (e.g. '-foffload=nvptx-none' or '--offload-arch=gfx90a'). The operands are
+//  uploaded once into zero padded 'tile << levels' squares, the recursion
+//  runs on the host but every add/sub and leaf product is a kernel on device
+//  pointers, and all temporaries come from a device arena. Without a device
+//  the target regions run on the host, which keeps the path testable.
+//  'STRASSEN_DEVICE=host' keeps every product on the CPU, 'target' forces
+//  the offload even without a device
+static int select_device() {
+    const char* forced = std::getenv("STRASSEN_DEVICE");
+    if (forced != nullptr && std::string(forced) == "host") return -1;
+    if (omp_get_num_devices() > 0) return omp_get_default_device();
+    if (forced != nullptr && std::string(forced) == "target") {
+        return omp_get_initial_device();
+    }
+    return -1;
+}
+
+static const int offload_device = select_device();
+
+// Leaves small enough for the CPU cutoff don't fill a device, the launch
+//  overhead dominates below this
+static constexpr int device_min_cutoff = 256;
+
+// Products under this edge don't amortise the upload and download of the
+//  operands, they stay on the host
+static constexpr int device_min_dimension = 1024;
+
+// 'c = a + sign * b' on device squares of 'n'
+template <typename T>
+static void device_combine(const T* a, int lda, const T* b, int ldb, int sign,
+                           T* c, int ldc, int n) {
+#pragma omp target teams distribute parallel for collapse(2) \
+    device(offload_device) is_device_ptr(a, b, c)
+    for (int x = 0; x < n; ++x) {
+        for (int y = 0; y < n; ++y) {
+            T u = a[ptrdiff_t(x) * lda + y], v = b[ptrdiff_t(x) * ldb + y];
+            c[ptrdiff_t(x) * ldc + y] =
+                sign > 0 ? wrap_add(u, v) : wrap_sub(u, v);
+        }
+    }
+}
+
+template <typename T>
+static void device_clear(T* c, int ldc, int rows, int cols) {
+#pragma omp target teams distribute parallel for collapse(2) \
+    device(offload_device) is_device_ptr(c)
+    for (int x = 0; x < rows; ++x) {
+        for (int y = 0; y < cols; ++y) c[ptrdiff_t(x) * ldc + y] = T(0);
+    }
+}
+
+// Leaf 'c = a * b', one device thread per entry of 'c' walks the inner
+//  dimension in chunks so neighbouring threads read the same row of 'a'
+//  and consecutive entries of a row of 'b'
+template <typename T>
+static void device_gemm(const T* a, int lda, const T* b, int ldb, T* c,
+                        int ldc, int n) {
+#pragma omp target teams distribute parallel for collapse(2) \
+    device(offload_device) is_device_ptr(a, b, c)
+    for (int x = 0; x < n; ++x) {
+        for (int y = 0; y < n; ++y) {
+            T acc = 0;
+            for (int k = 0; k < n; ++k) {
+                acc = wrap_add(acc, wrap_mul(a[ptrdiff_t(x) * lda + k],
+                                             b[ptrdiff_t(k) * ldb + y]));
+            }
+            c[ptrdiff_t(x) * ldc + y] = acc;
+        }
+    }
+}
+
+// Classic recursion on device views, with full even squares down to the
+//  leaves thanks to the padding. The views only carry device pointers, the
+//  host never dereferences them
+template <typename T>
+static void device_recursion(matrix_view<T> a, matrix_view<T> b,
+                             matrix_view<T> c, scratch_arena<T> scratch,
+                             int cutoff) {
+    int n = c.dimension;
+    if (n <= cutoff) {
+        device_gemm(a.data, a.stride, b.data, b.stride, c.data, c.stride, n);
+        return;
+    }
+
+    int half = n / 2;
+    matrix_view<T> m = scratch.allocate(half);
+    matrix_view<T> sums[2] = {scratch.allocate(half), scratch.allocate(half)};
+    device_clear(c.data, c.stride, n, n);
+
+    // Evaluates an operand into 'sum' if it is a sum
+    auto operand = [half](matrix_view<T> x, const strassen_operand& o,
+                          matrix_view<T> sum) {
+        matrix_view<T> q = x.sub(o.x, o.y);
+        if (o.sign == 0) return q;
+
+        matrix_view<T> r = x.sub(o.u, o.v);
+        device_combine(q.data, q.stride, r.data, r.stride, o.sign, sum.data,
+                       sum.stride, half);
+        return sum;
+    };
+
+    for (int p = 0; p < 7; ++p) {
+        device_recursion(operand(a, strassen_lhs[p], sums[0]),
+                         operand(b, strassen_rhs[p], sums[1]), m, scratch,
+                         cutoff);
+        for (const strassen_target& t : strassen_targets[p]) {
+            if (t.sign == 0) continue;
+            matrix_view<T> q = c.sub(t.x, t.y);
+            device_combine(q.data, q.stride, m.data, half, t.sign, q.data,
+                           q.stride, half);
+        }
+    }
+}
+
+// 'c = a * b' on the device for row-major views, false if the product stays
+//  on the host. Only the top-level products of 'multiply()' and the SERVE
+//  requests try it, the internal callers of 'strassen_mul()' (batch,
+//  out-of-core tiles, tuning, chains) don't pay a device round trip each
+template <typename T>
+static bool offload_mul(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+                        int cutoff) {
+    if (offload_device < 0 || a.tile != 0 || b.tile != 0 || c.tile != 0 ||
+        c.dimension < device_min_dimension) {
+        return false;
+    }
+
+    cutoff = std::max(cutoff, device_min_cutoff);
+    int levels = 0;
+    int tile = morton_tile(c.dimension, cutoff, levels);
+    int padded = tile << levels;
+    size_t square = size_t(padded) * padded;
+    size_t scratch = strassen_scratch_size(padded, cutoff);
+
+    int host = omp_get_initial_device();
+    T* memory = static_cast<T*>(
+        omp_target_alloc((3 * square + scratch) * sizeof(T), offload_device));
+    if (memory == nullptr) return false;
+
+    // Resident operands, zero outside of the backed extents
+    device_clear(memory, padded, 3 * padded, padded);
+    matrix_view<T> views[3] = {a, b, c};
+    for (int i = 0; i < 2; ++i) {
+        size_t volume[2] = {size_t(views[i].rows), size_t(views[i].cols)};
+        size_t offsets[2] = {0, 0};
+        size_t device_dims[2] = {size_t(padded), size_t(padded)};
+        size_t host_dims[2] = {size_t(views[i].rows), size_t(views[i].stride)};
+        omp_target_memcpy_rect(memory + i * square, views[i].data, sizeof(T),
+                               2, volume, offsets, offsets, device_dims,
+                               host_dims, offload_device, host);
+    }
+
+    matrix_view<T> da(memory, padded, padded);
+    matrix_view<T> db(memory + square, padded, padded);
+    matrix_view<T> dc(memory + 2 * square, padded, padded);
+    device_recursion(da, db, dc, scratch_arena<T>(memory + 3 * square, scratch),
+                     cutoff);
+
+    size_t volume[2] = {size_t(c.rows), size_t(c.cols)};
+    size_t offsets[2] = {0, 0};
+    size_t device_dims[2] = {size_t(padded), size_t(padded)};
+    size_t host_dims[2] = {size_t(c.rows), size_t(c.stride)};
+    omp_target_memcpy_rect(c.data, dc.data, sizeof(T), 2, volume, offsets,
+                           offsets, host_dims, device_dims, host,
+                           offload_device);
+
+    omp_target_free(memory, offload_device);
+    return true;
+}
+#endif
+
+// Strassen recursion of 'strassen_mul()'. Each level is a direct call of
+//  'multiply()'. Serial subproblems which halve evenly to a leaf size of
+//  'fixed_leaves' within 'fixed_levels' levels go through 'fixed<Leaf,
+//  Levels>()' instead, whose depth and leaf size are compile-time
+//  constants: every level is its own instantiation calling the next one, so
+//  the compiler sees the whole unrolled recursion. Both share 'step()', the
+//  classic and Winograd levels, task levels are 'parallel_step()'
+template <typename T>
+class strassen_recursion {
+   public:
+    strassen_recursion(int cutoff, thread_pool* pool, int spawn_depth,
+                       strassen_algorithm algorithm)
+        : cutoff(cutoff), spawn_depth(spawn_depth), pool(pool),
+          algorithm(algorithm) {}
+
+    void multiply(matrix_view<T> A, matrix_view<T> B, matrix_view<T> C,
+                  scratch_arena<T> S, int depth) {
+        if (depth >= spawn_depth && C.dimension > cutoff &&
+            multiply_fixed(A, B, C, S, depth)) {
+            return;
+        }
+
+        stats_scope level(depth);
+        stats_add(&level_stats::calls, 1);
+
+        if (C.dimension <= cutoff) {
+            leaf(A, B, C);
+            return;
+        }
+
+        if (C.dimension % 2 == 1) {
+            assert(!C.blocked());
+            int even = C.dimension - 1;
+            T* column = S.take(C.dimension);
+            multiply(A.top_left(even), B.top_left(even), C.top_left(even), S,
+                     depth);
+            stats_timer timer("peel", &level_stats::peel_ns);
+            peel_update(A, B, C, column);
+            return;
+        }
+
+        if (depth < spawn_depth) {
+            parallel_step(A, B, C, S, depth);
+            return;
+        }
+        step(A, B, C, S,
+             [this, depth](matrix_view<T> X, matrix_view<T> Y,
+                           matrix_view<T> Z, const scratch_arena<T>& R) {
+                 multiply(X, Y, Z, R, depth + 1);
+             });
+    }
+
+   private:
+    // Leaf sizes with a compile-time recursion, each of them down from
+    //  dimensions up to 'fixed_dimension'
+    static constexpr int fixed_dimension = 8192;
+    static constexpr int fixed_leaves[3] = {32, 64, 128};
+    static constexpr int fixed_levels = 8;  // log2(8192 / 32)
+
+    using entry = void (strassen_recursion::*)(matrix_view<T>, matrix_view<T>,
+                                               matrix_view<T>,
+                                               scratch_arena<T>, int);
+
+    int cutoff, spawn_depth;
+    thread_pool* pool;
+    strassen_algorithm algorithm;
+
+    void leaf(matrix_view<T> A, matrix_view<T> B, matrix_view<T> C) {
+        assert(!C.blocked());
+        stats_timer timer("leaf", &level_stats::leaf_ns);
+        stats_leaf<T>(C.dimension, 4 * size_t(C.dimension) * C.dimension);
+        leaf_mul(A, B, C);
+    }
+
+    template <int Leaf, int Levels>
+    void fixed(matrix_view<T> A, matrix_view<T> B, matrix_view<T> C,
+               scratch_arena<T> S, int depth) {
+        stats_scope level(depth);
+        stats_add(&level_stats::calls, 1);
+        assert(C.dimension == Leaf << Levels);
+
+        if constexpr (Levels == 0) {
+            leaf(A, B, C);
+        } else {
+            step(A, B, C, S,
+                 [this, depth](matrix_view<T> X, matrix_view<T> Y,
+                               matrix_view<T> Z, const scratch_arena<T>& R) {
+                     fixed<Leaf, Levels - 1>(X, Y, Z, R, depth + 1);
+                 });
+        }
+    }
+
+    // Dimensions above 'fixed_dimension' are not instantiated
+    template <int Leaf, int Levels>
+    static constexpr entry fixed_entry() {
+        if constexpr ((Leaf << Levels) <= fixed_dimension) {
+            return &strassen_recursion::fixed<Leaf, Levels>;
+        } else {
+            return nullptr;
+        }
+    }
+
+    template <int Leaf, size_t... Levels>
+    static constexpr std::array<entry, sizeof...(Levels)> fixed_entries(
+        std::index_sequence<Levels...>) {
+        return {{fixed_entry<Leaf, int(Levels)>()...}};
+    }
+
+    // Runs 'C' through its 'fixed()' instantiation, false if there is none.
+    //  The runtime recursion would take the same path: the dimension halves
+    //  evenly until it is under the cutoff
+    bool multiply_fixed(matrix_view<T> A, matrix_view<T> B, matrix_view<T> C,
+                        scratch_arena<T> S, int depth) {
+        using levels = std::make_index_sequence<fixed_levels + 1>;
+        static constexpr std::array<entry, fixed_levels + 1> entries[3] = {
+            fixed_entries<fixed_leaves[0]>(levels()),
+            fixed_entries<fixed_leaves[1]>(levels()),
+            fixed_entries<fixed_leaves[2]>(levels())};
+
+        int leaf = C.dimension, depth_left = 0;
+        while (leaf > cutoff && leaf % 2 == 0) {
+            leaf /= 2;
+            depth_left++;
+        }
+        if (leaf > cutoff || depth_left > fixed_levels) return false;
+
+        for (int i = 0; i < 3; ++i) {
+            if (leaf != fixed_leaves[i] || !entries[i][depth_left]) continue;
+            (this->*entries[i][depth_left])(A, B, C, S, depth);
+            return true;
+        }
+        return false;
+    }
+
+    // Task level, the seven products run on the pool with private slices
+    //  of 'S' and are combined once all of them have joined
+    void parallel_step(matrix_view<T> A, matrix_view<T> B, matrix_view<T> C,
+                       scratch_arena<T> S, int depth) {
+        matrix_view<T> C00 = C.sub(0, 0);
+        matrix_view<T> C01 = C.sub(0, 1);
+        matrix_view<T> C10 = C.sub(1, 0);
+        matrix_view<T> C11 = C.sub(1, 1);
+
+        int half = C00.dimension;
+        size_t below = strassen_scratch_size(half, cutoff, spawn_depth,
+                                             algorithm, depth + 1);
+        std::vector<matrix_view<T>> M;
+        std::vector<scratch_arena<T>> arenas;
+        for (int p = 0; p < 7; ++p) {
+            M.push_back(S.allocate(half, C.tile));
+            int sums =
+                (strassen_lhs[p].sign != 0) + (strassen_rhs[p].sign != 0);
+            arenas.push_back(S.split(sums * size_t(half) * half + below));
+        }
+
+        // Evaluates an operand into the task's arena if it is a sum
+        auto operand = [](matrix_view<T> X, const strassen_operand& o,
+                          scratch_arena<T>& arena) {
+            matrix_view<T> x = X.sub(o.x, o.y);
+            if (o.sign == 0) return x;
+
+            matrix_view<T> t = arena.allocate(x.dimension, x.tile);
+            if (o.sign > 0) {
+                sum(x, X.sub(o.u, o.v), t);
+            } else {
+                sub(x, X.sub(o.u, o.v), t);
+            }
+            return t;
+        };
+
+        task_group products(*pool);
+        for (int p = 0; p < 7; ++p) {
+            products.run([&, p]() {
+                stats_scope level(depth);
+                scratch_arena<T> arena = arenas[p];
+                matrix_view<T> lhs = operand(A, strassen_lhs[p], arena);
+                matrix_view<T> rhs = operand(B, strassen_rhs[p], arena);
+                multiply(lhs, rhs, M[p], arena, depth + 1);
+            });
+        }
+        products.wait();
+
+        // Every quadrant of C is written by exactly one task, the first
+        //  operation assigns it
+        task_group combine(*pool);
+        combine.run([&]() {
+            stats_scope level(depth);
+            sum(M[0], M[3], C00);
+            sub(C00, M[4], C00);
+            sum(C00, M[6], C00);
+        });
+        combine.run([&]() {
+            stats_scope level(depth);
+            sum(M[2], M[4], C01);
+        });
+        combine.run([&]() {
+            stats_scope level(depth);
+            sum(M[1], M[3], C10);
+        });
+        combine.run([&]() {
+            stats_scope level(depth);
+            sub(M[0], M[1], C11);
+            sum(C11, M[2], C11);
+            sum(C11, M[5], C11);
+        });
+        combine.wait();
+    }
+
+    // One sequential even level, 'next' multiplies the products one level
+    //  down
+    template <typename Next>
+    void step(matrix_view<T> A, matrix_view<T> B, matrix_view<T> C,
+              scratch_arena<T> S, Next next) {
+        matrix_view<T> A00 = A.sub(0, 0);
+        matrix_view<T> A01 = A.sub(0, 1);
+        matrix_view<T> A10 = A.sub(1, 0);
+        matrix_view<T> A11 = A.sub(1, 1);
+
+        matrix_view<T> B00 = B.sub(0, 0);
+        matrix_view<T> B01 = B.sub(0, 1);
+        matrix_view<T> B10 = B.sub(1, 0);
+        matrix_view<T> B11 = B.sub(1, 1);
+
+        matrix_view<T> C00 = C.sub(0, 0);
+        matrix_view<T> C01 = C.sub(0, 1);
+        matrix_view<T> C10 = C.sub(1, 0);
+        matrix_view<T> C11 = C.sub(1, 1);
+
+        int half = C00.dimension;
+
+        // Winograd keeps partial sums in the quadrants of C and combines
+        //  them across quadrants, every quadrant is fully backed as
+        //  'strassen_mul()' refuses a clipped C
+        if (algorithm == strassen_algorithm::winograd) {
+            // Operand temporaries, all seven products are written straight
+            //  into the quadrants of C or 'X' so C doesn't need clearing
+            matrix_view<T> X = S.allocate(half, C.tile);
+            matrix_view<T> Y = S.allocate(half, C.tile);
+            const scratch_arena<T>& SR = S;
+
+            sub(A00, A10, X);     // S3
+            sub(B11, B01, Y);     // T3
+            next(X, Y, C10, SR);  // P7
+
+            sum(A10, A11, X);     // S1
+            sub(B01, B00, Y);     // T1
+            next(X, Y, C11, SR);  // P5
+
+            sub(X, A00, X);       // S2
+            sub(B11, Y, Y);       // T2
+            next(X, Y, C01, SR);  // P6
+
+            sub(A01, X, X);         // S4
+            next(X, B11, C00, SR);  // P3
+
+            next(A00, B00, X, SR);  // P1
+            sum(X, C01, C01);       // U2
+            sum(C01, C10, C10);     // U3
+            sum(C01, C11, C01);     // U4
+            sum(C10, C11, C11);     // U7 = C11
+            sum(C01, C00, C01);     // U5 = C01
+
+            sub(Y, B10, Y);         // T4
+            next(A11, Y, C00, SR);  // P4
+            sub(C10, C00, C10);     // U6 = C10
+
+            next(A01, B10, C00, SR);  // P2
+            sum(X, C00, C00);         // U1 = C00
+            return;
+        }
+
+        if (half <= cutoff && fusable(A) && fusable(B) && fusable(C)) {
+            stats_timer timer("leaf", &level_stats::leaf_ns);
+            fused_strassen_leaves(A, B, C);
+            return;
+        }
+
+        // Storage space for the products which can't go straight into C
+        matrix_view<T> M = S.allocate(half, C.tile);
+
+        // Storage for sums
+        matrix_view<T> sum0 = S.allocate(half, C.tile);
+        matrix_view<T> sum1 = S.allocate(half, C.tile);
+
+        // The rest of 'S' is the recursive scratch space
+        const scratch_arena<T>& SR = S;
+
+        // M1, M2 and M3 are the first contributions to C00, C10 and C01,
+        //  they are computed in place so C needs no clearing
+
+        // Calculate M1
+        sum(A00, A11, sum0);
+        sum(B00, B11, sum1);
+        next(sum0, sum1, C00, SR);
+        assign(C00, C11);
+
+        // Calculate M2
+        sum(A10, A11, sum0);
+        next(sum0, B00, C10, SR);
+        sub(C11, C10, C11);
+
+        // Calculate M3
+        sub(B01, B11, sum0);
+        next(A00, sum0, C01, SR);
+        sum(C11, C01, C11);
+
+        // Calculate M4
+        sub(B10, B00, sum0);
+        next(A11, sum0, M, SR);
+        sum(C00, M, C00);
+        sum(C10, M, C10);
+
+        // Calculate M5
+        sum(A00, A01, sum0);
+        next(sum0, B11, M, SR);
+        sub(C00, M, C00);
+        sum(C01, M, C01);
+
+        // Caclulate M6
+        sub(A10, A00, sum0);
+        sum(B00, B01, sum1);
+        next(sum0, sum1, M, SR);
+        sum(C11, M, C11);
+
+        // Calculate M7
+        sub(A01, A11, sum0);
+        sum(B10, B11, sum1);
+        next(sum0, sum1, M, SR);
+        sum(C00, M, C00);
+    }
+};
+
+// Strassen multiplication 'c = a * b', all temporaries come from 'scratch'
+//  which has to hold 'strassen_scratch_size()' elements. Odd levels recurse
+//  on their even core and peel off the last row and column. With a 'pool' the
+//  seven products of the first 'spawn_depth' levels run as tasks, each with a
+//  private slice of the arena for its operand sums, result and recursion
+//  scratch; the quadrants of 'c' are only combined once all seven have joined.
+//  Task levels always use the classic operands, 'algorithm' picks the
+//  schedule of the sequential levels below them. 'c' has to be fully
+//  backed, the peeling and the Winograd schedule write every element of
+//  the square: a view clipped to a padded matrix throws std::invalid_argument
+template <typename T>
+void strassen_mul(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+                  scratch_arena<T> scratch, int cutoff,
+                  thread_pool* pool = nullptr, int spawn_depth = 0,
+                  strassen_algorithm algorithm = strassen_algorithm::classic) {
+    if (!c.backed()) {
+        throw std::invalid_argument("strassen_mul: c is a clipped view");
+    }
+    int dimension = c.dimension;
+    a.dimension = dimension;
+    b.dimension = dimension;
+    if (pool == nullptr) spawn_depth = 0;
+
+    strassen_recursion<T>(cutoff, pool, spawn_depth, algorithm)
+        .multiply(a, b, c, scratch, 0);
+}
+
+// Rectangular 'c = a * b' for the backed extents of row-major views, 'a' is
+//  'm' x 'k', 'b' is 'k' x 'n' and 'c' is 'm' x 'n'. The product is cut into
+//  square blocks with the edge 's' of its shortest side, i.e. the longer
+//  sides are split into runs of 's': every block product is a Strassen
+//  multiplication into a square temporary which is added into its block of
+//  'c'. Partial blocks at the far edges are staged zero padded so the
+//  recursion (and its peeling) only ever sees fully backed squares. Shapes
+//  whose shortest side is under the cutoff are a single leaf GEMM
+template <typename T>
+void strassen_rect_mul(
+    matrix_view<T> a, matrix_view<T> b, matrix_view<T> c, int cutoff,
+    thread_pool* pool = nullptr, int spawn_depth = 0,
+    strassen_algorithm algorithm = strassen_algorithm::classic) {
+    int m = c.rows, n = c.cols, k = a.cols;
+    assert(a.rows == m && b.rows == k && b.cols == n);
+
+    c.clear();
+    int s = std::min({m, k, n});
+    if (s <= cutoff) {
+        gemm(a.data, a.stride, b.data, b.stride, c.data, c.stride, m, n, k);
+        return;
+    }
+    if (pool == nullptr) spawn_depth = 0;
+
+    // Block '(x, y)' of a view, clamped to its backed extents
+    auto block = [s](matrix_view<T> v, int x, int y) {
+        return matrix_view<T>(v.data + ptrdiff_t(x) * s * v.stride +
+                                  ptrdiff_t(y) * s,
+                              v.stride, std::min(s, v.rows - x * s),
+                              std::min(s, v.cols - y * s), s);
+    };
+
+    // Copies a partial block into 'staging', zero padded to 's' x 's'
+    matrix_data<T> lhs(s), rhs(s), product(s);
+    auto stage = [s](matrix_view<T> v, matrix_data<T>& staging) {
+        if (v.rows == s && v.cols == s) return v;
+
+        matrix_view<T> full = staging.view();
+        full.clear();
+        for (int x = 0; x < v.rows; ++x) {
+            std::copy(v.row(x), v.row(x) + v.cols, full.row(x));
+        }
+        return full;
+    };
+
+    std::vector<T> scratch(
+        strassen_scratch_size(s, cutoff, spawn_depth, algorithm));
+    int blocks_m = (m + s - 1) / s, blocks_n = (n + s - 1) / s;
+    int blocks_k = (k + s - 1) / s;
+    for (int i = 0; i < blocks_m; ++i) {
+        for (int j = 0; j < blocks_n; ++j) {
+            matrix_view<T> target = block(c, i, j);
+            for (int l = 0; l < blocks_k; ++l) {
+                strassen_mul(stage(block(a, i, l), lhs),
+                             stage(block(b, l, j), rhs), product.view(),
+                             scratch_arena<T>(scratch.data(), scratch.size()),
+                             cutoff, pool, spawn_depth, algorithm);
+                sum(target, product.view(), target);
+            }
+        }
+    }
+}
+
+// Reusable setup of repeated 'dimension' x 'dimension' products, for
+//  powers, chains and sweeps. The Morton tile and padding, the scratch and
+//  the product buffers are worked out and allocated once. Operands live in
+//  the layout of the plan, so intermediates stay padded and tiled from one
+//  product to the next and only 'load()' and 'store()' convert
+template <typename T>
+class strassen_plan {
+   public:
+    // Storage of one operand, 'view' is in the layout of the plan
+    struct operand {
+        std::shared_ptr<T> memory;
+        matrix_view<T> view;
+    };
+
+    strassen_plan(int dimension, int cutoff, bool morton, thread_pool* pool,
+                  int spawn_depth, strassen_algorithm algorithm)
+        : dimension(dimension), cutoff(cutoff),
+          spawn_depth(pool != nullptr ? spawn_depth : 0), pool(pool),
+          algorithm(algorithm) {
+        padded = dimension;
+        if (morton) {
+            int levels = 0;
+            tile = morton_tile(dimension, cutoff, levels);
+            padded = tile << levels;
+        }
+        scratch_size =
+            strassen_scratch_size(padded, cutoff, this->spawn_depth, algorithm);
+        scratch = lazy_allocate<T>(scratch_size);
+    }
+
+    // An operand buffer which nothing outside of the plan holds any more,
+    //  or a new one
+    operand take() {
+        size_t count = size_t(padded) * padded;
+        std::shared_ptr<T> memory;
+        for (std::shared_ptr<T>& buffer : buffers) {
+            if (buffer.use_count() == 1) memory = buffer;
+        }
+        if (!memory) {
+            memory = lazy_allocate<T>(count);
+            buffers.push_back(memory);
+        }
+
+        if (tile == 0) {
+            return {memory, matrix_view<T>(memory.get(), dimension, dimension)};
+        }
+        return {memory, matrix_view<T>::morton(memory.get(), padded, tile)};
+    }
+
+    // Row-major 'src' into the layout of the plan and back
+    operand load(matrix_view<T> src) {
+        operand dst = take();
+        if (tile != 0) {
+            to_morton(src, dst.view);
+            return dst;
+        }
+        for (int x = 0; x < dimension; ++x) {
+            std::copy(src.row(x), src.row(x) + dimension, dst.view.row(x));
+        }
+        return dst;
+    }
+
+    void store(const operand& src, matrix_view<T> dst) const {
+        if (tile != 0) {
+            from_morton(src.view, dst);
+            return;
+        }
+        for (int x = 0; x < dimension; ++x) {
+            std::copy(src.view.row(x), src.view.row(x) + dimension,
+                      dst.row(x));
+        }
+    }
+
+    // 'c = a * b', 'c' must not share storage with 'a' or 'b'
+    void multiply(const operand& a, const operand& b, const operand& c) {
+        strassen_mul(a.view, b.view, c.view,
+                     scratch_arena<T>(scratch.get(), scratch_size), cutoff,
+                     pool, spawn_depth, algorithm);
+    }
+
+    operand multiply(const operand& a, const operand& b) {
+        operand c = take();
+        multiply(a, b, c);
+        return c;
+    }
+
+    // 'a^k' for 'k >= 1' by repeated squaring, 'log2(k) + popcount(k) - 1'
+    //  products
+    operand power(const operand& a, int k) {
+        assert(k >= 1);
+        operand base = a, result = a;
+        bool empty = true;
+        while (true) {
+            if ((k & 1) != 0) {
+                result = empty ? base : multiply(result, base);
+                empty = false;
+            }
+            k >>= 1;
+            if (k == 0) break;
+            base = multiply(base, base);
+        }
+
+        // Results never share the storage of the input
+        if (result.memory == a.memory) {
+            operand copy = take();
+            std::copy(a.memory.get(), a.memory.get() + size_t(padded) * padded,
+                      copy.memory.get());
+            result = copy;
+        }
+        return result;
+    }
+
+    // Left to right product of 'factors', all of them are this shape so
+    //  every order costs the same
+    operand chain(const std::vector<operand>& factors) {
+        assert(!factors.empty());
+        operand result = factors[0];
+        for (size_t i = 1; i < factors.size(); ++i) {
+            result = multiply(result, factors[i]);
+        }
+        return result;
+    }
+
+   private:
+    int dimension, cutoff, spawn_depth;
+    thread_pool* pool;
+    strassen_algorithm algorithm;
+    int padded, tile = 0;
+
+    size_t scratch_size;
+    std::shared_ptr<T> scratch;
+    std::vector<std::shared_ptr<T>> buffers;
+};
+
+// Cheapest order of the chain whose factor 'i' is 'dims[i]' x 'dims[i + 1]',
+//  the classic O(n^3) dynamic program over the 'm * k * n' cost of every
+//  product. 'split[i][j]' is where the product of factors 'i..j' is cut
+static std::vector<std::vector<int>> chain_order(const std::vector<int>& dims) {
+    int count = int(dims.size()) - 1;
+    std::vector<std::vector<double>> cost(count, std::vector<double>(count));
+    std::vector<std::vector<int>> split(count, std::vector<int>(count));
+    for (int length = 1; length < count; ++length) {
+        for (int i = 0; i + length < count; ++i) {
+            int j = i + length;
+            cost[i][j] = std::numeric_limits<double>::infinity();
+            for (int s = i; s < j; ++s) {
+                double c = cost[i][s] + cost[s + 1][j] +
+                           double(dims[i]) * dims[s + 1] * dims[j + 1];
+                if (c < cost[i][j]) {
+                    cost[i][j] = c;
+                    split[i][j] = s;
+                }
+            }
+        }
+    }
+    return split;
+}
+
+// Product of a chain of row-major factors in the order of 'chain_order()',
+//  every step is a 'strassen_rect_mul()'. Chains of squares of a single
+//  dimension go through one 'strassen_plan' instead
+template <typename T>
+static matrix_data<T> strassen_chain(
+    const std::vector<matrix_view<T>>& factors, int cutoff,
+    thread_pool* pool = nullptr, int spawn_depth = 0, bool morton = false,
+    strassen_algorithm algorithm = strassen_algorithm::classic) {
+    assert(!factors.empty());
+    std::vector<int> dims{factors[0].rows};
+    bool square = true;
+    for (const matrix_view<T>& f : factors) {
+        dims.push_back(f.cols);
+        square = square && f.rows == dims[0] && f.cols == dims[0];
+    }
+
+    if (square) {
+        strassen_plan<T> plan(dims[0], cutoff, morton, pool, spawn_depth,
+                              algorithm);
+        std::vector<typename strassen_plan<T>::operand> operands;
+        for (const matrix_view<T>& f : factors) {
+            operands.push_back(plan.load(f));
+        }
+
+        matrix_data<T> c(dims[0]);
+        plan.store(plan.chain(operands), c.view());
+        return c;
+    }
+
+    // Every intermediate is released as soon as the next step consumed it
+    std::vector<std::vector<int>> split = chain_order(dims);
+    std::function<matrix_data<T>(int, int)> product = [&](int i, int j) {
+        auto side = [&](int first, int last) {
+            return first == last ? matrix_data<T>(0) : product(first, last);
+        };
+        matrix_data<T> lhs = side(i, split[i][j]);
+        matrix_data<T> rhs = side(split[i][j] + 1, j);
+
+        matrix_data<T> c(dims[i], dims[j + 1]);
+        strassen_rect_mul(i == split[i][j] ? factors[i] : lhs.view(),
+                          split[i][j] + 1 == j ? factors[j] : rhs.view(),
+                          c.view(), cutoff, pool, spawn_depth, algorithm);
+        return c;
+    };
+    if (factors.size() > 1) return product(0, int(factors.size()) - 1);
+
+    matrix_data<T> c(dims[0], dims[1]);
+    for (int x = 0; x < dims[0]; ++x) {
+        std::copy(factors[0].row(x), factors[0].row(x) + dims[1], &c.at(x, 0));
+    }
+    return c;
+}
+
+#ifdef STRASSEN_MPI
+// Distributed Strassen over MPI
+//  rank 0 expands the top 'levels' of the recursion into '7^levels' products
+//  of 'ceil(n / 2^levels)' squares, which are dealt round robin over all
+//  ranks (rank 0 included) and multiplied by the regular 'strassen_mul'.
+//  Like the BFS and DFS steps of CAPS the schedule trades memory for rounds:
+//  'bfs' expands every level at once and runs a single round, 'dfs' walks all
+//  but the last level one product at a time on rank 0 and only distributes
+//  the seven products below it, '7^(levels - 1)' rounds which hold 7 instead
+//  of '7^levels' operand pairs. Transfers are non-blocking: rank 0 posts all
+//  sends and receives of a round and multiplies its own share meanwhile, the
+//  other ranks receive their next operands while they multiply
+template <typename T>
+class distributed_strassen {
+   public:
+    distributed_strassen(int levels, bool bfs, int cutoff, thread_pool* pool,
+                         int spawn_depth, strassen_algorithm algorithm)
+        : levels(levels), bfs(bfs), cutoff(cutoff), pool(pool),
+          spawn_depth(pool != nullptr ? spawn_depth : 0),
+          algorithm(algorithm) {
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    }
+
+    // Rank 0, 'c = a * b' on fully backed row-major views
+    void multiply(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+        walk(a, b, c, levels);
+    }
+
+    // Every other rank, serves its share of the rounds of a 'dimension'
+    //  product until it is done
+    void serve(int dimension) {
+        int size = dimension, tasks = 1, rounds = 1;
+        for (int l = 0; l < levels; ++l) {
+            size = ceil_divide(size);
+            tasks *= 7;
+        }
+        if (!bfs) {
+            rounds = tasks / 7;
+            tasks = 7;
+        }
+
+        std::vector<int> owned;
+        for (int i = rank; i < tasks; i += ranks) owned.push_back(i);
+        if (owned.empty()) return;
+
+        MPI_Datatype row = row_type(size);
+        for (int round = 0; round < rounds; ++round) {
+            // Double buffered operands, the next pair arrives meanwhile
+            std::vector<matrix_data<T>> lhs(2, matrix_data<T>(0));
+            std::vector<matrix_data<T>> rhs(2, matrix_data<T>(0));
+            for (int i = 0; i < 2; ++i) {
+                lhs[i] = matrix_data<T>(size);
+                rhs[i] = matrix_data<T>(size);
+            }
+            std::vector<MPI_Request> received(2), sent;
+            std::vector<matrix_data<T>> products;
+
+            receive(owned[0], row, lhs[0], rhs[0], received.data());
+            for (size_t j = 0; j < owned.size(); ++j) {
+                MPI_Waitall(2, received.data(), MPI_STATUSES_IGNORE);
+                if (j + 1 < owned.size()) {
+                    receive(owned[j + 1], row, lhs[(j + 1) % 2],
+                            rhs[(j + 1) % 2], received.data());
+                }
+
+                products.emplace_back(size);
+                local_mul(lhs[j % 2].view(), rhs[j % 2].view(),
+                          products.back().view());
+                sent.emplace_back();
+                MPI_Isend(&products.back().at(0), size, row, 0, owned[j],
+                          MPI_COMM_WORLD, &sent.back());
+            }
+            MPI_Waitall(int(sent.size()), sent.data(), MPI_STATUSES_IGNORE);
+        }
+        MPI_Type_free(&row);
+    }
+
+   private:
+    int levels;
+    bool bfs;
+    int cutoff;
+    thread_pool* pool;
+    int spawn_depth;
+    strassen_algorithm algorithm;
+    int rank, ranks;
+    std::vector<T> scratch;
+
+    // One row of a 'size' x 'size' square, messages are whole squares
+    static MPI_Datatype row_type(int size) {
+        MPI_Datatype row;
+        MPI_Type_contiguous(int(size * sizeof(T)), MPI_BYTE, &row);
+        MPI_Type_commit(&row);
+        return row;
+    }
+
+    void receive(int task, MPI_Datatype row, matrix_data<T>& lhs,
+                 matrix_data<T>& rhs, MPI_Request* requests) {
+        MPI_Irecv(&lhs.at(0), lhs.dimension, row, 0, 2 * task,
+                  MPI_COMM_WORLD, &requests[0]);
+        MPI_Irecv(&rhs.at(0), rhs.dimension, row, 0, 2 * task + 1,
+                  MPI_COMM_WORLD, &requests[1]);
+    }
+
+    void local_mul(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+        scratch.resize(
+            strassen_scratch_size(c.dimension, cutoff, spawn_depth, algorithm));
+        strassen_mul(a, b, c, scratch_arena<T>(scratch.data(), scratch.size()),
+                     cutoff, pool, spawn_depth, algorithm);
+    }
+
+    // Operand 'o' of a level evaluated into a fully backed square, the
+    //  quadrants of odd dimensions are zero padded
+    static matrix_data<T> operand(matrix_view<T> m, const strassen_operand& o) {
+        matrix_view<T> x = m.sub(o.x, o.y);
+        matrix_data<T> t(x.dimension);
+        if (o.sign == 0) {
+            for (int r = 0; r < x.rows; ++r) {
+                std::copy(x.row(r), x.row(r) + x.cols, t.view().row(r));
+            }
+        } else if (o.sign > 0) {
+            sum(x, m.sub(o.u, o.v), t.view());
+        } else {
+            sub(x, m.sub(o.u, o.v), t.view());
+        }
+        return t;
+    }
+
+    // Adds product 'p' of a level into the quadrants of 'c'
+    static void accumulate(matrix_view<T> c, int p, matrix_view<T> m) {
+        for (const strassen_target& t : strassen_targets[p]) {
+            matrix_view<T> q = c.sub(t.x, t.y);
+            if (t.sign > 0) sum(q, m, q);
+            if (t.sign < 0) sub(q, m, q);
+        }
+    }
+
+    // The operand pairs of 'a * b' expanded 'depth' levels deep
+    static void expand(matrix_view<T> a, matrix_view<T> b, int depth,
+                       std::vector<matrix_data<T>>& lhs,
+                       std::vector<matrix_data<T>>& rhs) {
+        for (int p = 0; p < 7; ++p) {
+            matrix_data<T> x = operand(a, strassen_lhs[p]);
+            matrix_data<T> y = operand(b, strassen_rhs[p]);
+            if (depth == 1) {
+                lhs.push_back(x);
+                rhs.push_back(y);
+            } else {
+                expand(x.view(), y.view(), depth - 1, lhs, rhs);
+            }
+        }
+    }
+
+    // Folds the products 'next', 'next + 1', ... of a 'depth' level expansion
+    //  back into 'c'
+    static void combine(std::vector<matrix_data<T>>& products, size_t& next,
+                        matrix_view<T> c, int depth) {
+        c.clear();
+        for (int p = 0; p < 7; ++p) {
+            if (depth == 1) {
+                accumulate(c, p, products[next++].view());
+                continue;
+            }
+            matrix_data<T> m(ceil_divide(c.dimension));
+            combine(products, next, m.view(), depth - 1);
+            accumulate(c, p, m.view());
+        }
+    }
+
+    // DFS levels on rank 0 until the distributed round
+    void walk(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+              int depth) {
+        if (bfs || depth == 1) {
+            distribute(a, b, c, depth);
+            return;
+        }
+
+        c.clear();
+        for (int p = 0; p < 7; ++p) {
+            matrix_data<T> x = operand(a, strassen_lhs[p]);
+            matrix_data<T> y = operand(b, strassen_rhs[p]);
+            matrix_data<T> m(x.dimension);
+            walk(x.view(), y.view(), m.view(), depth - 1);
+            accumulate(c, p, m.view());
+        }
+    }
+
+    // One round: every product of a 'depth' level expansion of 'a * b'
+    void distribute(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+                    int depth) {
+        std::vector<matrix_data<T>> lhs, rhs, products;
+        expand(a, b, depth, lhs, rhs);
+        int size = lhs[0].dimension;
+        MPI_Datatype row = row_type(size);
+
+        std::vector<MPI_Request> requests;
+        for (size_t i = 0; i < lhs.size(); ++i) {
+            products.emplace_back(size);
+            int owner = int(i) % ranks;
+            if (owner == 0) continue;
+
+            requests.resize(requests.size() + 3);
+            MPI_Request* r = &requests[requests.size() - 3];
+            MPI_Isend(&lhs[i].at(0), size, row, owner, 2 * int(i),
+                      MPI_COMM_WORLD, &r[0]);
+            MPI_Isend(&rhs[i].at(0), size, row, owner, 2 * int(i) + 1,
+                      MPI_COMM_WORLD, &r[1]);
+            MPI_Irecv(&products[i].at(0), size, row, owner, int(i),
+                      MPI_COMM_WORLD, &r[2]);
+        }
+        for (size_t i = 0; i < lhs.size(); i += ranks) {
+            local_mul(lhs[i].view(), rhs[i].view(), products[i].view());
+        }
+        MPI_Waitall(int(requests.size()), requests.data(),
+                    MPI_STATUSES_IGNORE);
+        MPI_Type_free(&row);
+
+        size_t next = 0;
+        combine(products, next, c, depth);
+    }
+};
+
+// Initializes MPI for the lifetime of 'main'
+struct mpi_session {
+    mpi_session() { MPI_Init(nullptr, nullptr); }
+    ~mpi_session() { MPI_Finalize(); }
+};
+#endif
+
+// Largest dimension whose batches use the interleaved kernels
+static constexpr int batch_interleave_max = 24;
+
+// Gathers entry '(x, y)' of 'lanes' row-major products into runs of
+//  'batch_lanes', unused lanes and entries outside of the views are zero
+template <typename T>
+static void interleave(const matrix_view<T>* m, int lanes, T* out) {
+    int n = m[0].dimension;
+    std::fill(out, out + size_t(n) * n * batch_lanes, T(0));
+    for (int l = 0; l < lanes; ++l) {
+        for (int x = 0; x < m[l].rows; ++x) {
+            const T* row = m[l].row(x);
+            T* run = out + size_t(x) * n * batch_lanes + l;
+            for (int y = 0; y < m[l].cols; ++y) {
+                run[y * batch_lanes] = row[y];
+            }
+        }
+    }
+}
+
+template <typename T>
+static void deinterleave(const T* in, int lanes, const matrix_view<T>* m) {
+    int n = m[0].dimension;
+    for (int l = 0; l < lanes; ++l) {
+        for (int x = 0; x < m[l].rows; ++x) {
+            for (int y = 0; y < m[l].cols; ++y) {
+                m[l].at(x, y) = in[(size_t(x) * n + y) * batch_lanes + l];
+            }
+        }
+    }
+}
+
+// 'c[i] = a[i] * b[i]' for 'count' row-major products of one dimension
+//  With a 'pool' the batch is cut into a few chunks per thread, every chunk
+//  runs sequentially on one scratch arena. Products up to
+//  'batch_interleave_max' go through the interleaved kernels 'batch_lanes' at
+//  a time, larger ones through 'strassen_mul'
+template <typename T>
+void strassen_batch(
+    const matrix_view<T>* a, const matrix_view<T>* b, const matrix_view<T>* c,
+    size_t count, int cutoff, thread_pool* pool = nullptr,
+    strassen_algorithm algorithm = strassen_algorithm::classic) {
+    if (count == 0) return;
+    int dimension = c[0].dimension;
+    bool interleaved = dimension <= batch_interleave_max;
+
+    auto chunk = [=](size_t first, size_t last) {
+        if (interleaved) {
+            size_t size = size_t(dimension) * dimension * batch_lanes;
+            std::vector<T> buffer(3 * size);
+            for (size_t i = first; i < last; i += batch_lanes) {
+                int lanes = int(std::min<size_t>(batch_lanes, last - i));
+                interleave(a + i, lanes, buffer.data());
+                interleave(b + i, lanes, buffer.data() + size);
+                kernels<T>.batch(buffer.data(), buffer.data() + size,
+                                 buffer.data() + 2 * size, dimension);
+                deinterleave(buffer.data() + 2 * size, lanes, c + i);
+            }
+            return;
+        }
+
+        std::vector<T> scratch(
+            strassen_scratch_size(dimension, cutoff, 0, algorithm));
+        for (size_t i = first; i < last; ++i) {
+            strassen_mul(a[i], b[i], c[i],
+                         scratch_arena<T>(scratch.data(), scratch.size()),
+                         cutoff, nullptr, 0, algorithm);
+        }
+    };
+
+    if (pool == nullptr) {
+        chunk(0, count);
+        return;
+    }
+
+    // Chunks stay multiples of the interleaved group
+    size_t unit = interleaved ? batch_lanes : 1;
+    size_t parts = 4 * size_t(pool->size());
+    size_t step = ((count + unit - 1) / unit + parts - 1) / parts * unit;
+
+    task_group group(*pool);
+    for (size_t first = 0; first < count; first += step) {
+        size_t last = std::min(count, first + step);
+        group.run([=]() { chunk(first, last); });
+    }
+    group.wait();
+}
+
+// Part of 'c = a * b' a caller asks for. Rows and columns are the half open
+//  range '[first, last)', entries are '(row, column)' pairs
+struct output_spec {
+    enum kind_t { full, diagonal, trace, rows, columns, entries };
+
+    kind_t kind = full;
+    int first = 0, last = 0;
+    std::vector<std::pair<int, int>> cells;
+};
+
+// Parses 'diagonal', 'trace', 'rows:F-L', 'columns:F-L' (inclusive 'L') or
+//  'entries:I,J;I,J;...', returns false on anything out of range
+static bool parse_output(const std::string& text, int dimension,
+                         output_spec& spec) {
+    std::string kind = text.substr(0, text.find(':'));
+    std::string args = kind.size() < text.size() ? text.substr(kind.size() + 1)
+                                                 : std::string();
+    spec = output_spec();
+
+    if (kind == "full" || kind == "diagonal" || kind == "trace") {
+        spec.kind = kind == "full"       ? output_spec::full
+                    : kind == "diagonal" ? output_spec::diagonal
+                                         : output_spec::trace;
+        return args.empty();
+    }
+
+    if (kind == "rows" || kind == "columns") {
+        spec.kind = kind == "rows" ? output_spec::rows : output_spec::columns;
+        size_t dash = args.find('-');
+        if (dash == std::string::npos) return false;
+        spec.first = to_int(args.substr(0, dash));
+        spec.last = to_int(args.substr(dash + 1)) + 1;
+        return 0 <= spec.first && spec.first < spec.last &&
+               spec.last <= dimension;
+    }
+
+    if (kind == "entries") {
+        spec.kind = output_spec::entries;
+        std::stringstream list(args);
+        for (std::string cell; getline(list, cell, ';');) {
+            size_t comma = cell.find(',');
+            if (comma == std::string::npos) return false;
+            int i = to_int(cell.substr(0, comma));
+            int j = to_int(cell.substr(comma + 1));
+            if (i < 0 || j < 0 || i >= dimension || j >= dimension) {
+                return false;
+            }
+            spec.cells.emplace_back(i, j);
+        }
+        return !spec.cells.empty();
+    }
+
+    return false;
+}
+
+// Computes only what 'spec' asks for of 'c = a * b' on row-major views and
+//  returns it row-major: the diagonal, a single trace, the requested entries
+//  in order, or the 'rows' x 'dimension' / 'dimension' x 'columns' strip.
+//  Single entries are dot products with a gathered column of 'b', so the
+//  diagonal and the trace are O(n^2); strips are one leaf GEMM over the
+//  rows or columns they need instead of a full product
+template <typename T>
+std::vector<T> partial_mul(matrix_view<T> a, matrix_view<T> b,
+                           const output_spec& spec) {
+    int n = a.dimension;
+    std::vector<T> column(n);
+    auto entry = [&](int i, int j) {
+        for (int k = 0; k < n; ++k) column[k] = b.get(k, j);
+        if (i >= a.rows) return T(0);
+        return kernels<T>.dot(a.row(i), column.data(), a.cols);
+    };
+
+    std::vector<T> out;
+    switch (spec.kind) {
+        case output_spec::diagonal:
+        case output_spec::trace:
+            for (int i = 0; i < n; ++i) out.push_back(entry(i, i));
+            if (spec.kind == output_spec::trace) {
+                T trace = T(0);
+                for (T value : out) trace += value;
+                out.assign(1, trace);
+            }
+            break;
+
+        case output_spec::entries:
+            for (const std::pair<int, int>& cell : spec.cells) {
+                out.push_back(entry(cell.first, cell.second));
+            }
+            break;
+
+        case output_spec::rows:
+        case output_spec::columns:
+        case output_spec::full: {
+            bool rows = spec.kind == output_spec::rows;
+            int first = spec.kind == output_spec::full ? 0 : spec.first;
+            int last = spec.kind == output_spec::full ? n : spec.last;
+            int width = last - first;
+
+            // 'a' restricted to the rows, or 'b' to the columns of the strip
+            matrix_view<T> lhs = a, rhs = b;
+            if (rows) {
+                lhs = matrix_view<T>(a.row(first), a.stride, width, a.cols, n);
+            } else {
+                rhs = matrix_view<T>(b.data + first, b.stride, b.rows, width,
+                                     n);
+            }
+
+            out.assign(size_t(n) * width, T(0));
+            int stride = rows ? n : width;
+            linear_mul(lhs, rhs,
+                       matrix_view<T>(out.data(), stride, rows ? width : n,
+                                      rows ? n : width, n));
+            break;
+        }
+    }
+    return out;
+}
+
+// The part of a full 'c' that 'spec' asks for, laid out like 'partial_mul()'
+template <typename T>
+std::vector<T> select_output(matrix_view<T> c, const output_spec& spec) {
+    int n = c.dimension;
+    std::vector<T> out;
+    switch (spec.kind) {
+        case output_spec::diagonal:
+        case output_spec::trace:
+            for (int i = 0; i < n; ++i) out.push_back(c.get(i, i));
+            if (spec.kind == output_spec::trace) {
+                T trace = T(0);
+                for (T value : out) trace += value;
+                out.assign(1, trace);
+            }
+            break;
+
+        case output_spec::entries:
+            for (const std::pair<int, int>& cell : spec.cells) {
+                out.push_back(c.get(cell.first, cell.second));
+            }
+            break;
+
+        case output_spec::rows:
+        case output_spec::columns:
+        case output_spec::full: {
+            bool rows = spec.kind == output_spec::rows;
+            int first = spec.kind == output_spec::full ? 0 : spec.first;
+            int last = spec.kind == output_spec::full ? n : spec.last;
+            for (int i = rows ? first : 0; i < (rows ? last : n); ++i) {
+                for (int j = rows ? 0 : first; j < (rows ? n : last); ++j) {
+                    out.push_back(c.get(i, j));
+                }
+            }
+            break;
+        }
+    }
+    return out;
+}
+
+// Bit-packed boolean matrix, one bit per entry: bit 'j % 64' of word
+//  'j / 64' of row 'i' is entry '(i, j)', the bits past 'dimension' are zero
+class bit_matrix {
+   public:
+    int dimension;
+    int words;
+
+    explicit bit_matrix(int dimension)
+        : dimension(dimension),
+          words((dimension + 63) / 64),
+          bits(size_t(dimension) * words) {}
+
+    bool get(int i, int j) const { return (row(i)[j / 64] >> (j % 64)) & 1; }
+    void set(int i, int j) { row(i)[j / 64] |= uint64_t(1) << (j % 64); }
+
+    uint64_t* row(int i) { return bits.data() + size_t(i) * words; }
+    const uint64_t* row(int i) const {
+        return bits.data() + size_t(i) * words;
+    }
+
+    // Nonzero entries of 'm' become ones
+    template <typename T>
+    static bit_matrix pack(matrix_view<T> m) {
+        bit_matrix packed(m.dimension);
+        for (int i = 0; i < m.dimension; ++i) {
+            for (int j = 0; j < m.dimension; ++j) {
+                if (m.get(i, j) != T(0)) packed.set(i, j);
+            }
+        }
+        return packed;
+    }
+
+    void unpack(matrix_view<int> m) const {
+        for (int i = 0; i < dimension; ++i) {
+            for (int j = 0; j < dimension; ++j) m.at(i, j) = get(i, j);
+        }
+    }
+
+    bit_matrix transposed() const {
+        bit_matrix t(dimension);
+        for (int i = 0; i < dimension; ++i) {
+            for (int j = 0; j < dimension; ++j) {
+                if (get(i, j)) t.set(j, i);
+            }
+        }
+        return t;
+    }
+
+   private:
+    std::vector<uint64_t> bits;
+};
+
+// Population counts of 'a & b[t]' over 'words' words for four rows 'b[t]',
+//  sharing the loads of 'a'. Uses the POPCNT instruction where the CPU has it
+static void and_count4_portable(const uint64_t* a, const uint64_t* const* b,
+                                int words, int* counts) {
+    int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    for (int w = 0; w < words; ++w) {
+        c0 += __builtin_popcountll(a[w] & b[0][w]);
+        c1 += __builtin_popcountll(a[w] & b[1][w]);
+        c2 += __builtin_popcountll(a[w] & b[2][w]);
+        c3 += __builtin_popcountll(a[w] & b[3][w]);
+    }
+    counts[0] = c0;
+    counts[1] = c1;
+    counts[2] = c2;
+    counts[3] = c3;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("popcnt"))) static void and_count4_popcnt(
+    const uint64_t* a, const uint64_t* const* b, int words, int* counts) {
+    int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    for (int w = 0; w < words; ++w) {
+        c0 += __builtin_popcountll(a[w] & b[0][w]);
+        c1 += __builtin_popcountll(a[w] & b[1][w]);
+        c2 += __builtin_popcountll(a[w] & b[2][w]);
+        c3 += __builtin_popcountll(a[w] & b[3][w]);
+    }
+    counts[0] = c0;
+    counts[1] = c1;
+    counts[2] = c2;
+    counts[3] = c3;
+}
+#endif
+
+typedef void (*and_count4_kernel)(const uint64_t*, const uint64_t* const*, int,
+                                  int*);
+
+static and_count4_kernel select_and_count4() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt")) return and_count4_popcnt;
+#endif
+    return and_count4_portable;
+}
+
+static const and_count4_kernel and_count4 = select_and_count4();
+
+// Runs 'func(first, last)' over row ranges of '[0, rows)', split into a few
+//  tasks per thread with a 'pool'
+static void for_row_ranges(int rows, thread_pool* pool,
+                           std::function<void(int, int)> func) {
+    if (pool == nullptr) {
+        func(0, rows);
+        return;
+    }
+
+    int parts = 2 * pool->size();
+    int step = (rows + parts - 1) / parts;
+    task_group group(*pool);
+    for (int first = 0; first < rows; first += step) {
+        int last = std::min(rows, first + step);
+        group.run([=, &func]() { func(first, last); });
+    }
+    group.wait();
+}
+
+// Counting product of boolean matrices 'c = a * b' over the integers, every
+//  entry is the popcount of a row of 'a' and a column of 'b' (a row of the
+//  transposed 'bt'). Columns are walked in blocks whose rows stay cached
+static void bit_count_mul(const bit_matrix& a, const bit_matrix& bt,
+                          matrix_view<int> c, thread_pool* pool) {
+    constexpr int block = 256;
+    for_row_ranges(c.dimension, pool, [&](int first, int last) {
+        for (int j0 = 0; j0 < c.dimension; j0 += block) {
+            int j1 = std::min(c.dimension, j0 + block);
+            for (int i = first; i < last; ++i) {
+                const uint64_t* ar = a.row(i);
+                int* cr = c.row(i);
+                for (int j = j0; j < j1; j += 4) {
+                    // The last group repeats its final column
+                    const uint64_t* b[4];
+                    for (int t = 0; t < 4; ++t) {
+                        b[t] = bt.row(std::min(j + t, j1 - 1));
+                    }
+                    int counts[4];
+                    and_count4(ar, b, a.words, counts);
+                    std::copy_n(counts, std::min(4, j1 - j), cr + j);
+                }
+            }
+        }
+    });
+}
+
+// Product over GF(2) 'c = a * b' (AND for the products, XOR for the sums)
+//  by the method of Four Russians: for every group of 8 rows of 'b' all 256
+//  XOR combinations are tabulated, so each row of 'c' takes one table row per
+//  byte of the matching row of 'a' instead of one row of 'b' per bit
+static void bit_gf2_mul(const bit_matrix& a, const bit_matrix& b,
+                        bit_matrix& c, thread_pool* pool) {
+    constexpr int group = 8;
+    const int words = b.words;
+    for_row_ranges(c.dimension, pool, [&](int first, int last) {
+        std::vector<uint64_t> table((1 << group) * size_t(words));
+        for (int i = first; i < last; ++i) {
+            std::fill(c.row(i), c.row(i) + words, 0);
+        }
+
+        for (int k0 = 0; k0 < b.dimension; k0 += group) {
+            // Entry 'm' is entry 'm' without its lowest set bit XOR the row
+            //  of that bit, so every combination is one row XOR
+            std::fill(table.begin(), table.begin() + words, 0);
+            for (int m = 1; m < (1 << group); ++m) {
+                int bit = __builtin_ctz(m);
+                uint64_t* out = table.data() + size_t(m) * words;
+                const uint64_t* prev =
+                    table.data() + size_t(m & (m - 1)) * words;
+                if (k0 + bit >= b.dimension) {
+                    std::copy_n(prev, words, out);
+                    continue;
+                }
+                const uint64_t* br = b.row(k0 + bit);
+                for (int w = 0; w < words; ++w) out[w] = prev[w] ^ br[w];
+            }
+
+            for (int i = first; i < last; ++i) {
+                int index = (a.row(i)[k0 / 64] >> (k0 % 64)) & 0xff;
+                if (index == 0) continue;
+                const uint64_t* tr = table.data() + size_t(index) * words;
+                uint64_t* cr = c.row(i);
+                for (int w = 0; w < words; ++w) cr[w] ^= tr[w];
+            }
+        }
+    });
+}
+
+// Maps 'path' privately, writes to the mapping stay in memory (copy on
+//  write), returns null if the file can't be mapped
+static std::shared_ptr<void> map_file(const std::string& path, size_t& size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    size = size_t(info.st_size);
+    void* memory =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+
+    madvise(memory, size, MADV_SEQUENTIAL);
+    return std::shared_ptr<void>(memory,
+                                 [size](void* m) { munmap(m, size); });
+}
+
+// Binary input: this header followed by the matrices as row-major elements
+//  of 'element_size' bytes in host byte order
+struct binary_header {
+    char magic[8];
+    uint32_t element_size;
+    uint32_t dimension;
+};
+
+static const char binary_magic[8] = {'S', 'T', 'R', 'A', 'S', 'S', 'E', 'N'};
+
+// Reads the input matrices from 'path', A and B or the pairs 'A0 B0 A1 B1 ...'
+//  of a batch. Binary files are adopted in place without copying, text files
+//  hold one integer per line (any whitespace works) and are parsed straight
+//  out of the mapping
+template <typename T>
+static bool load_matrices(const std::string& path, int dimension,
+                          std::vector<matrix_data<T>>& matrices) {
+    size_t size = 0;
+    std::shared_ptr<void> file = map_file(path, size);
+    if (!file) return false;
+
+    const char* text = static_cast<const char*>(file.get());
+    size_t count = size_t(dimension) * dimension;
+    size_t total = matrices.size() * count;
+    bool square = true;
+    for (matrix_data<T>& m : matrices) {
+        square = square && m.rows == dimension && m.cols == dimension;
+    }
+
+    binary_header header;
+    if (size >= sizeof(header) &&
+        std::equal(binary_magic, binary_magic + 8, text)) {
+        std::memcpy(&header, text, sizeof(header));
+        if (!square || header.element_size != sizeof(T) ||
+            int(header.dimension) != dimension ||
+            size < sizeof(header) + total * sizeof(T)) {
+            std::cerr << "      Binary input doesn't hold " << matrices.size()
+                      << " " << dimension << "x" << dimension
+                      << " matrices\n";
+            return false;
+        }
+
+        T* payload = reinterpret_cast<T*>(static_cast<char*>(file.get()) +
+                                          sizeof(header));
+        for (size_t m = 0; m < matrices.size(); ++m) {
+            matrices[m] = matrix_data<T>(dimension, payload + m * count, file);
+        }
+        return true;
+    }
+
+    // Missing entries stay zero, anything past the last matrix is ignored.
+    //  Rectangular matrices hold 'rows * cols' entries each
+    const char* end = text + size;
+    size_t i = 0;
+    for (matrix_data<T>& m : matrices) {
+        for (size_t e = 0; e < size_t(m.rows) * m.cols; ++e, ++i) {
+            while (text != end &&
+                   std::isspace(static_cast<unsigned char>(*text))) {
+                ++text;
+            }
+            if (text == end) return true;
+
+            T value;
+            std::from_chars_result parsed = std::from_chars(text, end, value);
+            if (parsed.ec != std::errc()) {
+                std::cerr << "      Malformed input at entry " << i << "\n";
+                return false;
+            }
+            text = parsed.ptr;
+
+            m.at(e) = value;
+        }
+    }
+
+    return true;
+}
+
+// Writes the input matrices in the binary input format
+template <typename T>
+static bool save_binary(const std::string& path,
+                        std::vector<matrix_data<T>>& matrices) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    binary_header header;
+    std::copy(binary_magic, binary_magic + 8, header.magic);
+    header.element_size = sizeof(T);
+    header.dimension = uint32_t(matrices[0].dimension);
+
+    size_t bytes = size_t(header.dimension) * header.dimension * sizeof(T);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (matrix_data<T>& m : matrices) {
+        file.write(reinterpret_cast<const char*>(&m.at(0)), bytes);
+    }
+    return bool(file);
+}
+
+// Reads or writes exactly 'bytes' at 'offset', I/O errors end the run
+static void read_all(int fd, void* memory, size_t bytes, off_t offset) {
+    char* out = static_cast<char*>(memory);
+    while (bytes > 0) {
+        ssize_t done = pread(fd, out, bytes, offset);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) throw std::runtime_error("Out-of-core read failed");
+        out += done;
+        offset += done;
+        bytes -= size_t(done);
+    }
+}
+
+static void write_all(int fd, const void* memory, size_t bytes,
+                      off_t offset) {
+    const char* in = static_cast<const char*>(memory);
+    while (bytes > 0) {
+        ssize_t done = pwrite(fd, in, bytes, offset);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) throw std::runtime_error("Out-of-core write failed");
+        in += done;
+        offset += done;
+        bytes -= size_t(done);
+    }
+}
+
+// Morton ordered square matrix stored at 'offset' of a file, the on-disk
+//  counterpart of a Morton 'matrix_view': every quadrant is a contiguous run
+template <typename T>
+struct disk_matrix {
+    int fd;
+    off_t offset;
+    int dimension;
+
+    size_t count() const { return size_t(dimension) * dimension; }
+
+    disk_matrix<T> sub(int x, int y) const {
+        int half = dimension / 2;
+        off_t quadrant = off_t(half) * half * sizeof(T);
+        return disk_matrix<T>{fd, offset + (2 * x + y) * quadrant, half};
+    }
+};
+
+// Out-of-core multiplication
+//  A, B, C and the scratch of the top levels live in one unlinked file under
+//  'directory', in the Morton layout with leaf tiles under the cutoff. Levels
+//  whose blocks plus in-core scratch exceed the memory budget run the classic
+//  schedule over the file with streamed add/sub passes, where the next chunk
+//  is prefetched by a helper thread. Blocks that fit are read into memory and
+//  multiplied there by 'strassen_mul' with the 'pool', 'spawn_depth' and
+//  'algorithm' the budget was sized for
+template <typename T>
+class out_of_core {
+   public:
+    out_of_core(const std::string& directory, size_t budget, int dimension,
+                int cutoff, thread_pool* pool, int spawn_depth,
+                strassen_algorithm algorithm)
+        : dimension(dimension),
+          cutoff(cutoff),
+          pool(pool),
+          spawn_depth(pool != nullptr ? spawn_depth : 0),
+          algorithm(algorithm) {
+        int levels = 0;
+        tile = morton_tile(dimension, cutoff, levels);
+        padded = tile << levels;
+
+        // Largest block that fits into memory with its in-core scratch
+        in_core = padded;
+        while (in_core > tile && in_core_bytes(in_core) > budget) {
+            in_core /= 2;
+        }
+
+        std::string path = directory + "/strassen.XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        fd = mkstemp(name.data());
+        if (fd < 0) return;
+        unlink(name.data());
+
+        // A, B and C followed by three quadrants for every level on disk
+        size_t count = size_t(padded) * padded;
+        off_t size = off_t(3 * count);
+        for (int d = padded; d > in_core; d /= 2) {
+            size += 3 * off_t(d / 2) * (d / 2);
+        }
+        size *= sizeof(T);
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            fd = -1;
+            return;
+        }
+
+        a = disk_matrix<T>{fd, 0, padded};
+        b = disk_matrix<T>{fd, off_t(count * sizeof(T)), padded};
+        c = disk_matrix<T>{fd, off_t(2 * count * sizeof(T)), padded};
+        scratch_offset = off_t(3 * count * sizeof(T));
+    }
+
+    ~out_of_core() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool ok() const { return fd >= 0; }
+
+    // 'c = a * b' for the row-major inputs
+    void multiply(matrix_view<T> av, matrix_view<T> bv) {
+        store(av, a);
+        store(bv, b);
+
+        memory.resize(in_core_bytes(in_core) / sizeof(T));
+        recurse(a, b, c, scratch_offset);
+        memory = std::vector<T>();
+    }
+
+    // Copies C back into a row-major view
+    void load(matrix_view<T> out) {
+        std::vector<T> leaf(size_t(tile) * tile);
+        for_each_tile([&](int tx, int ty, off_t offset) {
+            read_all(fd, leaf.data(), leaf.size() * sizeof(T),
+                     c.offset + offset * off_t(sizeof(T)));
+            matrix_view<T> src(leaf.data(), tile, tile);
+            for (int x = 0; x < tile && tx * tile + x < out.rows; ++x) {
+                int width = std::max(0, std::min(tile, out.cols - ty * tile));
+                std::copy_n(src.row(x), width,
+                            out.row(tx * tile + x) + ty * tile);
+            }
+        });
+    }
+
+    // Single entry of the diagonal of C
+    T diagonal(int i) {
+        int t = i / tile, x = i % tile;
+        off_t offset = off_t(morton_index(t, t, levels())) * tile * tile +
+                       off_t(x) * tile + x;
+        T value;
+        read_all(fd, &value, sizeof(value), c.offset + offset * sizeof(T));
+        return value;
+    }
+
+   private:
+    int dimension, cutoff;
+    thread_pool* pool;
+    int spawn_depth;
+    strassen_algorithm algorithm;
+    int tile, padded, in_core;
+    int fd = -1;
+    disk_matrix<T> a, b, c;
+    off_t scratch_offset = 0;
+
+    // Operands, result and scratch of the in-core blocks
+    std::vector<T> memory;
+
+    // Chunk of the streamed passes, in elements
+    static constexpr size_t chunk = size_t(1) << 20;
+
+    size_t in_core_bytes(int d) const {
+        return (3 * size_t(d) * d +
+                strassen_scratch_size(d, cutoff, spawn_depth, algorithm)) *
+               sizeof(T);
+    }
+
+    int levels() const {
+        int levels = 0;
+        while ((tile << levels) < padded) levels++;
+        return levels;
+    }
+
+    // Calls 'func(tile row, tile column, offset in elements)' for every leaf
+    template <typename Func>
+    void for_each_tile(Func func) {
+        int grid = padded / tile, l = levels();
+        for (int tx = 0; tx < grid; ++tx) {
+            for (int ty = 0; ty < grid; ++ty) {
+                func(tx, ty, off_t(morton_index(tx, ty, l)) * tile * tile);
+            }
+        }
+    }
+
+    // Writes a row-major view into Morton tiles on disk, zero padded
+    void store(matrix_view<T> src, disk_matrix<T> dst) {
+        std::vector<T> leaf(size_t(tile) * tile);
+        for_each_tile([&](int tx, int ty, off_t offset) {
+            std::fill(leaf.begin(), leaf.end(), 0);
+            int width = std::max(0, std::min(tile, src.cols - ty * tile));
+            for (int x = 0; x < tile && tx * tile + x < src.rows; ++x) {
+                std::copy_n(src.row(tx * tile + x) + ty * tile, width,
+                            leaf.data() + size_t(x) * tile);
+            }
+            write_all(fd, leaf.data(), leaf.size() * sizeof(T),
+                      dst.offset + offset * off_t(sizeof(T)));
+        });
+    }
+
+    // 'out = x op y' (or a copy of 'x' without 'row_op') streamed in chunks,
+    //  the next chunk of the inputs is read while the current one is combined
+    void stream(disk_matrix<T> x, disk_matrix<T> y, disk_matrix<T> out,
+                void (*row_op)(const T*, const T*, T*, int)) {
+        size_t count = x.count();
+        std::vector<T> buffers[2][2];
+        for (auto& pair : buffers) {
+            pair[0].resize(std::min(chunk, count));
+            pair[1].resize(row_op != nullptr ? std::min(chunk, count) : 0);
+        }
+
+        auto fetch = [&](int slot, size_t begin) {
+            size_t n = std::min(chunk, count - begin);
+            off_t at = off_t(begin * sizeof(T));
+            read_all(fd, buffers[slot][0].data(), n * sizeof(T),
+                     x.offset + at);
+            if (row_op != nullptr) {
+                read_all(fd, buffers[slot][1].data(), n * sizeof(T),
+                         y.offset + at);
+            }
+        };
+
+        fetch(0, 0);
+        for (size_t begin = 0, slot = 0; begin < count;
+             begin += chunk, slot ^= 1) {
+            std::future<void> next;
+            if (begin + chunk < count) {
+                next = std::async(std::launch::async, fetch, int(slot ^ 1),
+                                  begin + chunk);
+            }
+
+            size_t n = std::min(chunk, count - begin);
+            T* xs = buffers[slot][0].data();
+            if (row_op != nullptr) {
+                row_op(xs, buffers[slot][1].data(), xs, int(n));
+            }
+            write_all(fd, xs, n * sizeof(T),
+                      out.offset + off_t(begin * sizeof(T)));
+
+            if (next.valid()) next.get();
+        }
+    }
+
+    // Reads both operands (concurrently), multiplies in memory, writes C
+    void multiply_in_core(disk_matrix<T> A, disk_matrix<T> B,
+                          disk_matrix<T> C) {
+        size_t count = A.count();
+        T* am = memory.data();
+        T* bm = am + count;
+        T* cm = bm + count;
+        T* sm = cm + count;
+
+        std::future<void> second = std::async(std::launch::async, [&]() {
+            read_all(fd, bm, count * sizeof(T), B.offset);
+        });
+        read_all(fd, am, count * sizeof(T), A.offset);
+        second.get();
+
+        int d = A.dimension;
+        strassen_mul(matrix_view<T>::morton(am, d, tile),
+                     matrix_view<T>::morton(bm, d, tile),
+                     matrix_view<T>::morton(cm, d, tile),
+                     scratch_arena<T>(sm, memory.size() - 3 * count), cutoff,
+                     pool, spawn_depth, algorithm);
+        write_all(fd, cm, count * sizeof(T), C.offset);
+    }
+
+    // Classic schedule over disk blocks. The first product of every quadrant
+    //  is written there directly, so C never needs clearing
+    void recurse(disk_matrix<T> A, disk_matrix<T> B, disk_matrix<T> C,
+                 off_t next) {
+        if (A.dimension <= in_core) {
+            multiply_in_core(A, B, C);
+            return;
+        }
+
+        disk_matrix<T> A00 = A.sub(0, 0), A01 = A.sub(0, 1);
+        disk_matrix<T> A10 = A.sub(1, 0), A11 = A.sub(1, 1);
+        disk_matrix<T> B00 = B.sub(0, 0), B01 = B.sub(0, 1);
+        disk_matrix<T> B10 = B.sub(1, 0), B11 = B.sub(1, 1);
+        disk_matrix<T> C00 = C.sub(0, 0), C01 = C.sub(0, 1);
+        disk_matrix<T> C10 = C.sub(1, 0), C11 = C.sub(1, 1);
+
+        int half = A.dimension / 2;
+        off_t quadrant = off_t(half) * half * sizeof(T);
+        disk_matrix<T> M{fd, next, half};
+        disk_matrix<T> sum0{fd, next + quadrant, half};
+        disk_matrix<T> sum1{fd, next + 2 * quadrant, half};
+        off_t below = next + 3 * quadrant;
+
+        void (*add)(const T*, const T*, T*, int) = kernels<T>.add;
+        void (*subtract)(const T*, const T*, T*, int) = kernels<T>.sub;
+
+        // M1 -> C00, C11
+        stream(A00, A11, sum0, add);
+        stream(B00, B11, sum1, add);
+        recurse(sum0, sum1, C00, below);
+        stream(C00, C00, C11, nullptr);
+
+        // M2 -> C10, -C11
+        stream(A10, A11, sum0, add);
+        recurse(sum0, B00, C10, below);
+        stream(C11, C10, C11, subtract);
+
+        // M3 -> C01, C11
+        stream(B01, B11, sum0, subtract);
+        recurse(A00, sum0, C01, below);
+        stream(C11, C01, C11, add);
+
+        // M4 -> C00, C10
+        stream(B10, B00, sum0, subtract);
+        recurse(A11, sum0, M, below);
+        stream(C00, M, C00, add);
+        stream(C10, M, C10, add);
+
+        // M5 -> -C00, C01
+        stream(A00, A01, sum0, add);
+        recurse(sum0, B11, M, below);
+        stream(C00, M, C00, subtract);
+        stream(C01, M, C01, add);
+
+        // M6 -> C11
+        stream(A10, A00, sum0, subtract);
+        stream(B00, B01, sum1, add);
+        recurse(sum0, sum1, M, below);
+        stream(C11, M, C11, add);
+
+        // M7 -> C00
+        stream(A01, A11, sum0, subtract);
+        stream(B10, B11, sum1, add);
+        recurse(sum0, sum1, M, below);
+        stream(C00, M, C00, add);
+    }
+};
+
+// Crossover cutoffs measured by the TUNE mode, 'odd_cutoff' is used for odd
+//  dimensions where the top level pays for peeling
+struct tuning_profile {
+    std::string kernel;
+    int cutoff = 32;
+    int odd_cutoff = 32;
+};
+
+// Reads a 'key=value' profile, returns false if it is missing or was tuned
+//  for a different kernel set
+static bool load_profile(const std::string& path, tuning_profile& profile) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    tuning_profile loaded;
+    std::string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) continue;
+
+        std::string key = line.substr(0, eq), value = line.substr(eq + 1);
+        if (key == "kernel") loaded.kernel = value;
+        if (key == "cutoff") loaded.cutoff = std::max(to_int(value), 1);
+        if (key == "odd_cutoff") {
+            loaded.odd_cutoff = std::max(to_int(value), 1);
+        }
+    }
+
+    if (loaded.kernel != kernels<int>.name) return false;
+    profile = loaded;
+    return true;
+}
+
+static bool save_profile(const std::string& path,
+                         const tuning_profile& profile) {
+    std::ofstream file(path);
+    if (!file.is_open()) return false;
+
+    file << "# strassen tuning profile, regenerate with './strassen "
+         << debug_flags::TUNE << " [DIMENSION] [PROFILE]'\n";
+    file << "kernel=" << profile.kernel << "\n";
+    file << "cutoff=" << profile.cutoff << "\n";
+    file << "odd_cutoff=" << profile.odd_cutoff << "\n";
+    return bool(file);
+}
+
+// Best run time of 'func' in seconds, repeated for at least a few runs and
+//  a short time budget to filter out noise
+static double measure(std::function<void(void)> func) {
+    using clock = std::chrono::steady_clock;
+
+    double best = 1e30;
+    auto deadline = clock::now() + std::chrono::milliseconds(50);
+    for (int runs = 0; runs < 3 || clock::now() < deadline; ++runs) {
+        auto start = clock::now();
+        func();
+        std::chrono::duration<double> dur = clock::now() - start;
+        best = std::min(best, dur.count());
+    }
+
+    return best;
+}
+
+// Walks the dimensions 'first', 'first + step', ... up to 'last' and returns
+//  the cutoff at which one level of Strassen (peeled like a real run) starts
+//  to beat the leaf kernel, two wins in a row are needed to count
+static int find_crossover(int first, int last, int step) {
+    int wins = 0;
+    for (int dimension = first; dimension <= last; dimension += step) {
+        matrix_data<int> a(dimension);
+        matrix_data<int> b(dimension);
+        random_matrix(a, 0, random_spec(), nullptr);
+        random_matrix(b, 1, random_spec(), nullptr);
+
+        matrix_data<int> leaf(dimension);
+        double linear = measure([&]() {
+            leaf.view().clear();
+            linear_mul(a.view(), b.view(), leaf.view());
+        });
+
+        // Odd dimensions get peeled down to the even core first
+        int half = dimension / 2;
+        matrix_data<int> c(dimension);
+        std::vector<int> scratch(strassen_scratch_size(dimension, half));
+        double strassen = measure([&]() {
+            strassen_mul(a.view(), b.view(), c.view(),
+                         scratch_arena(scratch.data(), scratch.size()), half);
+        });
+
+        std::cout << "    " << dimension << ": linear " << linear * 1e3
+                  << "ms, strassen " << strassen * 1e3 << "ms\n";
+
+        wins = strassen < linear ? wins + 1 : 0;
+        if (wins == 2) return std::max(dimension - 2 * step, first / 2);
+    }
+
+    return last;
+}
+
+static int tune(int dimension, const std::string& path) {
+    tuning_profile profile;
+    profile.kernel = kernels<int>.name;
+
+    std::cout << "tuning " << profile.kernel << " kernels up to " << dimension
+              << "\n";
+    profile.cutoff = find_crossover(16, dimension, 16);
+    std::cout << "cutoff: " << profile.cutoff << "\n";
+    profile.odd_cutoff = find_crossover(17, dimension, 16);
+    std::cout << "odd cutoff: " << profile.odd_cutoff << "\n";
+
+    if (!save_profile(path, profile)) {
+        std::cerr << "      Unable to write profile: \"" << path << "\""
+                  << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// VERIFY comparison, exact for integers. Floating point products only agree
+//  up to rounding, Strassen sums the terms in a different order
+template <typename T>
+static bool matches(T value, T expected) {
+    if (!std::is_floating_point<T>::value) return value == expected;
+
+    T tolerance = std::sqrt(std::numeric_limits<T>::epsilon());
+    return std::abs(value - expected) <= tolerance * (std::abs(expected) + 1);
+}
+
+// Runs 'body(first, last)' over chunks of the rows '[0, rows)', spread over
+//  the pool when there is one
+static void parallel_rows(int rows, thread_pool* pool,
+                          const std::function<void(int, int)>& body) {
+    int parts = pool != nullptr ? 4 * pool->size() : 1;
+    int step = std::max(1, (rows + parts - 1) / parts);
+    if (pool == nullptr || step >= rows) {
+        body(0, rows);
+        return;
+    }
+
+    task_group group(*pool);
+    for (int first = 0; first < rows; first += step) {
+        group.run([=, &body]() { body(first, std::min(rows, first + step)); });
+    }
+    group.wait();
+}
+
+template <typename T>
+static bool matches(matrix_view<T> c, matrix_view<T> check,
+                    thread_pool* pool = nullptr) {
+    std::atomic<bool> equal{true};
+    parallel_rows(c.dimension, pool, [&](int first, int last) {
+        for (int x = first; x < last && equal; ++x) {
+            for (int y = 0; y < c.dimension; ++y) {
+                if (!matches(c.get(x, y), check.get(x, y))) {
+                    equal = false;
+                    break;
+                }
+            }
+        }
+    });
+    return equal;
+}
+
+// Arithmetic of the Freivalds check, integers wrap like the product itself
+template <typename T, bool = std::is_floating_point<T>::value>
+struct freivalds_word {
+    using type = double;
+};
+
+template <typename T>
+struct freivalds_word<T, false> {
+    using type = typename std::make_unsigned<T>::type;
+};
+
+// Freivalds' check of 'c == a * b' in O(rounds * n^2): 'c V' is compared
+//  with 'a (b V)' for an 'n' x 'rounds' block 'V' of random 0/1 vectors, a
+//  wrong 'c' passes each of them with probability at most 1/2. All rounds
+//  share one pass over every matrix. Integers are compared modulo 2^bits,
+//  floating point entries up to the tolerance of 'matches' scaled by
+//  '|a| (|b| V)'. Row-major views only
+template <typename T>
+static bool freivalds(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c,
+                      int rounds, uint64_t seed, thread_pool* pool) {
+    using word = typename freivalds_word<T>::type;
+    const bool floating = std::is_floating_point<T>::value;
+    int n = c.dimension;
+    size_t width = size_t(rounds);
+    assert(!a.blocked() && !b.blocked() && !c.blocked());
+
+    // 'out = m in' on 'n' x 'rounds' blocks, or '|m| in' with 'magnitude',
+    //  unbacked entries of 'm' are zero
+    auto product = [&](matrix_view<T> m, const auto& in, auto& out,
+                       bool magnitude) {
+        using value = typename std::decay<decltype(in[0])>::type;
+        parallel_rows(n, pool, [&](int first, int last) {
+            for (int x = first; x < last; ++x) {
+                value* total = &out[x * width];
+                std::fill(total, total + width, value(0));
+                if (x >= m.rows) continue;
+
+                const T* row = m.row(x);
+                for (int y = 0; y < std::min(m.cols, n); ++y) {
+                    value entry = magnitude ? value(std::abs(double(row[y])))
+                                            : value(row[y]);
+                    const value* vector = &in[y * width];
+                    for (size_t r = 0; r < width; ++r) {
+                        total[r] += entry * vector[r];
+                    }
+                }
+            }
+        });
+    };
+
+    size_t size = size_t(n) * width;
+    std::vector<word> v(size), bv(size), abv(size), cv(size);
+    for (size_t y = 0; y < size_t(n); ++y) {
+        uint64_t key = random_key(seed, (uint64_t(1) << 32) + y);
+        for (size_t r = 0; r < width; ++r) {
+            v[y * width + r] = word(random_bits(key, r) & 1);
+        }
+    }
+
+    product(b, v, bv, false);
+    product(a, bv, abv, false);
+    product(c, v, cv, false);
+    if (!floating) return cv == abv;
+
+    std::vector<double> ones(v.begin(), v.end()), bound(size), scale(size);
+    product(b, ones, bound, true);
+    product(a, bound, scale, true);
+
+    double tolerance = std::sqrt(std::numeric_limits<T>::epsilon());
+    for (size_t i = 0; i < size; ++i) {
+        if (std::abs(double(cv[i]) - double(abv[i])) >
+            tolerance * (scale[i] + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parsed command line of a multiplication run
+struct run_options {
+    int debug;
+    int dimension;
+    int cutoff;
+    int threads;
+    int spawn_depth;
+    bool morton;
+    strassen_algorithm algorithm;
+    size_t batch;
+    std::string input;
+    std::map<std::string, std::string> options;
+    random_spec random;
+};
+
+// VERIFY of 'c == a * b', '--verify exact' multiplies again with
+//  'linear_mul' and compares in parallel, '--verify freivalds' runs
+//  '--rounds' Freivalds rounds instead
+template <typename T>
+static bool verify_product(run_options& run, matrix_view<T> a,
+                           matrix_view<T> b, matrix_view<T> c,
+                           thread_pool* pool) {
+    std::map<std::string, std::string>& options = run.options;
+    bool timed = (run.debug & debug_flags::TIME) != 0;
+    bool equal = false;
+
+    if (options.count("verify") != 0 && options["verify"] == "freivalds") {
+        int rounds = 16;
+        if (options.count("rounds") != 0) rounds = to_int(options["rounds"]);
+
+        auto task = [&]() {
+            equal = freivalds(a, b, c, rounds, run.random.seed, pool);
+        };
+        if (timed) {
+            std::cout << "freivalds: ";
+            time(task);
+        } else {
+            task();
+        }
+        return equal;
+    }
+
+    matrix_data<T> check(c.dimension);
+    auto task = [&]() { linear_mul(a, b, check.view()); };
+    if (timed) {
+        std::cout << "linear: ";
+        time(task);
+    } else {
+        task();
+    }
+
+    if (options.count("modulus") != 0) {
+        reduce_modulo(check.view(), std::atoll(options["modulus"].c_str()));
+    }
+    if ((run.debug & debug_flags::PRINT) != 0) {
+        std::cout << "check:\n" << check.view();
+    }
+    return matches(c, check.view(), pool);
+}
+
+// Batch mode: 'inputs' holds the pairs 'A0 B0 A1 B1 ...', the products share
+//  the pool, kernels and per-thread scratch of one 'strassen_batch()' call
+template <typename T>
+static int run_batch(run_options& run, std::vector<matrix_data<T>>& inputs,
+                     int cutoff, thread_pool* pool,
+                     strassen_algorithm algorithm) {
+    int debug = run.debug;
+    size_t count = inputs.size() / 2;
+    int dimension = inputs[0].dimension;
+
+    std::vector<matrix_data<T>> outputs;
+    std::vector<matrix_view<T>> a, b, c;
+    for (size_t i = 0; i < count; ++i) {
+        outputs.emplace_back(dimension);
+        a.push_back(inputs[2 * i].view());
+        b.push_back(inputs[2 * i + 1].view());
+        c.push_back(outputs[i].view());
+    }
+
+    auto task = [&]() {
+        strassen_batch(a.data(), b.data(), c.data(), count, cutoff, pool,
+                       algorithm);
+    };
+    if ((debug & debug_flags::TIME) != 0) {
+        std::cout << "strassen batch: ";
+        time(task);
+    } else {
+        task();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if ((debug & debug_flags::PRINT) != 0) {
+            std::cout << "A" << i << ":\n" << a[i];
+            std::cout << "B" << i << ":\n" << b[i];
+            std::cout << "C" << i << ":\n" << c[i];
+        }
+
+        if ((debug & debug_flags::VERIFY) != 0) {
+            if (!verify_product(run, a[i], b[i], c[i], pool)) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+
+        // Print the diagonals to standard output, one product after another
+        if (debug == 0) {
+            for (int x = 0; x < dimension; ++x) {
+                std::cout << c[i].get(x, x) << "\n";
+            }
+        }
+    }
+    return 0;
+}
+
+// Rectangular run of '--shape M,K,N': an 'M' x 'K' A times a 'K' x 'N' B,
+//  text inputs hold the entries of A and then B row by row
+template <typename T>
+static int multiply_rectangular(run_options run) {
+    int debug = run.debug;
+    std::map<std::string, std::string>& options = run.options;
+
+    std::vector<int> shape;
+    if (!parse_counts(options, "shape", 0, shape) || shape.size() != 3 ||
+        run.morton || options.count("batch") != 0 ||
+        options.count("output") != 0 || options.count("out-of-core") != 0 ||
+        options.count("write-binary") != 0) {
+        return usage();
+    }
+    int m = shape[0], k = shape[1], n = shape[2];
+
+    std::vector<matrix_data<T>> inputs;
+    inputs.emplace_back(m, k);
+    inputs.emplace_back(k, n);
+    std::unique_ptr<thread_pool> pool;
+    if (run.threads > 1) pool.reset(new thread_pool(run.threads));
+
+    if ((debug & debug_flags::RANDOM) != 0) {
+        random_matrix(inputs[0], 0, run.random, pool.get());
+        random_matrix(inputs[1], 1, run.random, pool.get());
+    } else if (!load_matrices(run.input, std::max({m, k, n}), inputs)) {
+        std::cerr << "      Unable to open file: \"" << run.input << "\""
+                  << std::endl;
+        return -1;
+    }
+
+    matrix_view<T> a = inputs[0].view(), b = inputs[1].view();
+    matrix_data<T> c(m, n);
+    auto task = [&]() {
+        strassen_rect_mul(a, b, c.view(), run.cutoff, pool.get(),
+                          run.spawn_depth, run.algorithm);
+    };
+    if ((debug & debug_flags::TIME) != 0) {
+        std::cout << "strassen: ";
+        time(task);
+    } else {
+        task();
+    }
+
+    if ((debug & debug_flags::PRINT) != 0) {
+        std::cout << "A:\n" << a;
+        std::cout << "B:\n" << b;
+    }
+    if ((debug & debug_flags::PRINT) != 0 || debug == 0) {
+        for (int i = 0; i < m; ++i) {
+            for (int j = 0; j < n; ++j) std::cout << c.at(i, j) << " ";
+            std::cout << "\n";
+        }
+    }
+
+    if ((debug & debug_flags::VERIFY) != 0) {
+        matrix_data<T> check(m, n);
+        gemm(a.data, a.stride, b.data, b.stride, check.view().data, n, m, n, k);
+        for (size_t i = 0; i < size_t(m) * n; ++i) {
+            if (!matches(c.at(i), check.at(i))) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Chain run of '--chain D0,D1,...,DN': factor 'i' is 'Di' x 'D(i+1)' and
+//  text inputs hold the factors one after another. '--power K' is 'A^K' of
+//  the 'DIMENSION' square A through one 'strassen_plan'
+template <typename T>
+static int multiply_chain(run_options run) {
+    int debug = run.debug;
+    std::map<std::string, std::string>& options = run.options;
+
+    std::vector<int> dims;
+    int power = 0;
+    if (options.count("power") != 0) {
+        power = to_int(options["power"]);
+        dims.assign(2, run.dimension);
+    } else if (!parse_counts(options, "chain", 0, dims) || dims.size() < 2) {
+        return usage();
+    }
+    if ((options.count("power") != 0 &&
+         (power <= 0 || options.count("chain") != 0)) ||
+        options.count("batch") != 0 || options.count("output") != 0 ||
+        options.count("out-of-core") != 0 ||
+        options.count("write-binary") != 0) {
+        return usage();
+    }
+    size_t count = dims.size() - 1;
+
+    std::unique_ptr<thread_pool> pool;
+    if (run.threads > 1) pool.reset(new thread_pool(run.threads));
+
+    std::vector<matrix_data<T>> inputs;
+    for (size_t i = 0; i < count; ++i) {
+        inputs.emplace_back(dims[i], dims[i + 1]);
+    }
+    if ((debug & debug_flags::RANDOM) != 0) {
+        for (size_t i = 0; i < count; ++i) {
+            random_matrix(inputs[i], i, run.random, pool.get());
+        }
+    } else if (!load_matrices(run.input,
+                              *std::max_element(dims.begin(), dims.end()),
+                              inputs)) {
+        std::cerr << "      Unable to open file: \"" << run.input << "\""
+                  << std::endl;
+        return -1;
+    }
+
+    std::vector<matrix_view<T>> factors;
+    for (matrix_data<T>& input : inputs) factors.push_back(input.view());
+
+    int m = dims.front(), n = dims.back();
+    matrix_data<T> c(m, n);
+    auto task = [&]() {
+        if (power == 0) {
+            c = strassen_chain(factors, run.cutoff, pool.get(),
+                               run.spawn_depth, run.morton, run.algorithm);
+            return;
+        }
+        strassen_plan<T> plan(m, run.cutoff, run.morton, pool.get(),
+                              run.spawn_depth, run.algorithm);
+        plan.store(plan.power(plan.load(factors[0]), power), c.view());
+    };
+    if ((debug & debug_flags::TIME) != 0) {
+        std::cout << (power != 0 ? "strassen power: " : "strassen chain: ");
+        time(task);
+    } else {
+        task();
+    }
+
+    if ((debug & debug_flags::PRINT) != 0) {
+        for (size_t i = 0; i < count; ++i) {
+            std::cout << "A" << i << ":\n" << factors[i];
+        }
+        std::cout << "C:\n";
+        for (int i = 0; i < m; ++i) {
+            for (int j = 0; j < n; ++j) std::cout << c.at(i, j) << " ";
+            std::cout << "\n";
+        }
+    }
+
+    // The left to right product of the factors, or of 'power' copies of A
+    if ((debug & debug_flags::VERIFY) != 0) {
+        matrix_data<T> check = inputs[0];
+        for (size_t i = 1; i < std::max(count, size_t(power)); ++i) {
+            matrix_view<T> next = factors[power != 0 ? 0 : i];
+            matrix_data<T> product(check.rows, next.cols);
+            gemm(check.view().data, check.view().stride, next.data,
+                 next.stride, product.view().data, product.view().stride,
+                 check.rows, next.cols, next.rows);
+            check = product;
+        }
+        for (size_t i = 0; i < size_t(m) * n; ++i) {
+            if (!matches(c.at(i), check.at(i))) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    // Print diagonal of square results or all of C to standard output
+    if (debug == 0) {
+        for (int i = 0; i < m; ++i) {
+            if (m == n) {
+                std::cout << c.at(i, i) << "\n";
+                continue;
+            }
+            for (int j = 0; j < n; ++j) std::cout << c.at(i, j) << " ";
+            std::cout << "\n";
+        }
+    }
+    return 0;
+}
+
+// Distributed run of '--distribute LEVELS' under mpirun, rank 0 loads or
+//  generates the inputs and reports like a regular run while the other ranks
+//  only multiply their share of the products
+template <typename T>
+static int multiply_distributed(run_options run) {
+#ifdef STRASSEN_MPI
+    int debug = run.debug, dimension = run.dimension;
+    std::map<std::string, std::string>& options = run.options;
+
+    int levels = to_int(options["distribute"]);
+    std::string schedule = "bfs";
+    if (options.count("schedule") != 0) schedule = options["schedule"];
+    if (levels <= 0 || (schedule != "bfs" && schedule != "dfs") ||
+        run.morton || options.count("batch") != 0 ||
+        options.count("output") != 0 || options.count("out-of-core") != 0) {
+        return usage();
+    }
+
+    std::unique_ptr<thread_pool> pool;
+    if (run.threads > 1) pool.reset(new thread_pool(run.threads));
+    distributed_strassen<T> engine(levels, schedule == "bfs", run.cutoff,
+                                   pool.get(), run.spawn_depth,
+                                   run.algorithm);
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // The other ranks wait for rank 0 to have its inputs
+    matrix_data<T> a(rank == 0 ? dimension : 0), b(rank == 0 ? dimension : 0);
+    int ok = 1;
+    if (rank == 0 && (debug & debug_flags::RANDOM) != 0) {
+        random_matrix(a, 0, run.random, nullptr);
+        random_matrix(b, 1, run.random, nullptr);
+    } else if (rank == 0) {
+        std::vector<matrix_data<T>> inputs = {a, b};
+        ok = load_matrices(run.input, dimension, inputs);
+        a = inputs[0];
+        b = inputs[1];
+        if (!ok) {
+            std::cerr << "      Unable to open file: \"" << run.input << "\""
+                      << std::endl;
+        }
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!ok) return -1;
+
+    if (rank != 0) {
+        engine.serve(dimension);
+        return 0;
+    }
+
+    matrix_data<T> c(dimension);
+    auto task = [&]() { engine.multiply(a.view(), b.view(), c.view()); };
+    if ((debug & debug_flags::TIME) != 0) {
+        std::cout << "strassen: ";
+        time(task);
+    } else {
+        task();
+    }
+
+    if ((debug & debug_flags::PRINT) != 0) {
+        std::cout << "A:\n" << a.view();
+        std::cout << "B:\n" << b.view();
+        std::cout << "C:\n" << c.view();
+    }
+
+    if ((debug & debug_flags::VERIFY) != 0) {
+        if (!verify_product(run, a.view(), b.view(), c.view(), nullptr)) {
+            std::cerr << "      Verification failed" << std::endl;
+            return -1;
+        }
+    }
+
+    // Print diagonal to standard output
+    if (debug == 0) {
+        for (int i = 0; i < dimension; ++i) std::cout << c.at(i, i) << "\n";
+    }
+    return 0;
+#else
+    (void)run;
+    std::cerr << "      Distributed runs need an MPI build, compile with "
+                 "mpicxx -DSTRASSEN_MPI"
+              << std::endl;
+    return -1;
+#endif
+}
+
+// Multiply server
+//  the SERVE mode listens on the UNIX socket in INPUT and keeps its thread
+//  pool, the selected kernels, the tuned cutoffs and a cache of scratch
+//  arenas warm across requests. A request names a POSIX shared memory
+//  segment with A, B and room for C as consecutive row-major 'dimension^2'
+//  blocks, the server maps it and writes C in place so the operands are
+//  never copied or parsed. Replies are sent as products complete and carry
+//  the 'id' of their request: a client can pipeline any number of requests
+//  on a connection, '--in-flight' of them run at the same time on the pool
+struct serve_request {
+    uint64_t id;
+    uint32_t op;         // 'serve_op'
+    uint32_t element;    // index into 'element_names'
+    uint32_t dimension;
+    uint32_t algorithm;  // 0 classic, 1 winograd
+    char segment[64];    // 'shm_open' name
+};
+
+struct serve_reply {
+    uint64_t id;
+    int32_t status;   // 0 once C is in the segment
+    uint32_t micros;  // time of the product
+};
+
+enum serve_op : uint32_t { serve_multiply = 1, serve_shutdown = 2 };
+
+// Largest 'dimension' a request may name, 3 * 32768^2 doubles are 24 GiB
+static const uint32_t serve_max_dimension = 1u << 15;
+
+static const char* const element_names[4] = {"int32", "int64", "float",
+                                              "double"};
+
+template <typename T>
+static uint32_t element_index() {
+    if (std::is_same<T, int64_t>::value) return 1;
+    if (std::is_same<T, float>::value) return 2;
+    if (std::is_same<T, double>::value) return 3;
+    return 0;
+}
+
+// Sends or receives exactly 'bytes', false once the peer is gone
+static bool send_all(int fd, const void* memory, size_t bytes) {
+    const char* in = static_cast<const char*>(memory);
+    while (bytes > 0) {
+        ssize_t done = send(fd, in, bytes, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return false;
+        in += done;
+        bytes -= size_t(done);
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void* memory, size_t bytes) {
+    char* out = static_cast<char*>(memory);
+    while (bytes > 0) {
+        ssize_t done = recv(fd, out, bytes, 0);
+        if (done < 0 && errno == EINTR) continue;
+        if (done <= 0) return false;
+        out += done;
+        bytes -= size_t(done);
+    }
+    return true;
+}
+
+// Maps the first 'bytes' of shared memory segment 'name', null if it is
+//  missing or too small
+static std::shared_ptr<void> map_segment(const std::string& name,
+                                         size_t bytes) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (bytes == 0 || fstat(fd, &info) != 0 || size_t(info.st_size) < bytes) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* memory =
+        mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) return nullptr;
+    return std::shared_ptr<void>(memory,
+                                 [bytes](void* m) { munmap(m, bytes); });
+}
+
+// SIGINT and SIGTERM stop the accept loop, the products in flight finish
+static int server_listener = -1;
+
+static void stop_listening(int) {
+    if (server_listener >= 0) shutdown(server_listener, SHUT_RDWR);
+}
+
+class multiply_server {
+   public:
+    multiply_server(int threads, int spawn_depth, tuning_profile profile,
+                    int in_flight)
+        : spawn_depth(spawn_depth), profile(profile), in_flight(in_flight) {
+        if (threads > 1) pool.reset(new thread_pool(threads));
+        if (!pool) this->spawn_depth = 0;
+    }
+
+    int serve(const std::string& path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) return -1;
+        std::copy(path.begin(), path.end(), address.sun_path);
+
+        // A socket left behind by an earlier server is replaced
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            unlink(path.c_str());
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 ||
+            bind(listener, reinterpret_cast<sockaddr*>(&address),
+                 sizeof(address)) != 0 ||
+            listen(listener, 16) != 0) {
+            if (listener >= 0) close(listener);
+            return -1;
+        }
+        server_listener = listener;
+        signal(SIGINT, stop_listening);
+        signal(SIGTERM, stop_listening);
+
+        std::vector<std::thread> executors;
+        for (int i = 0; i < in_flight; ++i) {
+            executors.emplace_back([this]() { execute(); });
+        }
+
+        // Readers are detached and counted, every one ends with its client so
+        //  a long-running server only keeps the threads of live connections
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0 && errno == EINTR) continue;
+            if (fd < 0) break;
+
+            std::shared_ptr<connection> from(new connection(fd));
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (stopping) break;
+                connections.erase(
+                    std::remove_if(connections.begin(), connections.end(),
+                                   [](const std::weak_ptr<connection>& weak) {
+                                       return weak.expired();
+                                   }),
+                    connections.end());
+                connections.push_back(from);
+                ++readers;
+            }
+            std::thread([this, from]() {
+                read_requests(from);
+                std::lock_guard<std::mutex> guard(lock);
+                --readers;
+                finished.notify_all();
+            }).detach();
+        }
+
+        stop();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [this]() { return readers == 0; });
+        }
+        for (std::thread& executor : executors) executor.join();
+        server_listener = -1;
+        close(listener);
+        unlink(path.c_str());
+        return 0;
+    }
+
+   private:
+    // Closed once the reader and every pending reply are done with it
+    struct connection {
+        explicit connection(int fd) : fd(fd) {}
+        ~connection() { close(fd); }
+
+        int fd;
+        std::mutex write_lock;
+    };
+
+    struct job {
+        serve_request request;
+        std::shared_ptr<connection> from;
+    };
+
+    std::unique_ptr<thread_pool> pool;
+    int spawn_depth;
+    tuning_profile profile;
+    int in_flight;
+    int listener = -1;
+
+    std::mutex lock;
+    std::condition_variable ready, finished;
+    std::deque<job> jobs;
+    std::vector<std::weak_ptr<connection>> connections;
+    int readers = 0;
+    bool stopping = false;
+
+    // Scratch arenas of finished requests and their sizes in bytes
+    std::mutex scratch_lock;
+    std::vector<std::pair<size_t, std::shared_ptr<char>>> scratch_cache;
+
+    // Ends the accept loop and wakes up the readers, queued jobs still run
+    void stop() {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        ready.notify_all();
+        shutdown(listener, SHUT_RDWR);
+        for (std::weak_ptr<connection>& weak : connections) {
+            std::shared_ptr<connection> from = weak.lock();
+            if (from) shutdown(from->fd, SHUT_RD);
+        }
+    }
+
+    static void reply(connection& to, const serve_reply& message) {
+        std::lock_guard<std::mutex> guard(to.write_lock);
+        send_all(to.fd, &message, sizeof(message));
+    }
+
+    void read_requests(std::shared_ptr<connection> from) {
+        serve_request request;
+        while (recv_all(from->fd, &request, sizeof(request))) {
+            if (request.op == serve_shutdown) {
+                reply(*from, serve_reply{request.id, 0, 0});
+                stop();
+                return;
+            }
+            if (request.op != serve_multiply || request.element >= 4 ||
+                request.dimension == 0 ||
+                request.dimension > serve_max_dimension ||
+                request.algorithm > 1) {
+                reply(*from, serve_reply{request.id, -1, 0});
+                continue;
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(job{request, from});
+            ready.notify_one();
+        }
+    }
+
+    void execute() {
+        while (true) {
+            job next;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                ready.wait(guard,
+                           [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                next = jobs.front();
+                jobs.pop_front();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            int status = -1;
+            switch (next.request.element) {
+                case 0: status = multiply<int32_t>(next.request); break;
+                case 1: status = multiply<int64_t>(next.request); break;
+                case 2: status = multiply<float>(next.request); break;
+                case 3: status = multiply<double>(next.request); break;
+            }
+            std::chrono::microseconds micros =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start);
+            reply(*next.from, serve_reply{next.request.id, status,
+                                          uint32_t(micros.count())});
+        }
+    }
+
+    // Smallest cached arena of at least 'bytes', or a new one
+    std::pair<size_t, std::shared_ptr<char>> take_scratch(size_t bytes) {
+        std::lock_guard<std::mutex> guard(scratch_lock);
+        auto best = scratch_cache.end();
+        for (auto it = scratch_cache.begin(); it != scratch_cache.end(); ++it) {
+            if (it->first >= bytes &&
+                (best == scratch_cache.end() || it->first < best->first)) {
+                best = it;
+            }
+        }
+        if (best == scratch_cache.end()) {
+            return {bytes, lazy_allocate<char>(bytes)};
+        }
+
+        std::pair<size_t, std::shared_ptr<char>> scratch = *best;
+        scratch_cache.erase(best);
+        return scratch;
+    }
+
+    template <typename T>
+    int multiply(const serve_request& request) {
+        if (request.dimension == 0 ||
+            request.dimension > serve_max_dimension) {
+            return -1;
+        }
+        int n = int(request.dimension);
+        size_t square = size_t(n) * n;
+        if (square > std::numeric_limits<size_t>::max() / (3 * sizeof(T))) {
+            return -1;
+        }
+        std::string name(request.segment,
+                         strnlen(request.segment, sizeof(request.segment)));
+        std::shared_ptr<void> segment =
+            map_segment(name, 3 * square * sizeof(T));
+        if (!segment) return -1;
+
+        T* a = static_cast<T*>(segment.get());
+        matrix_view<T> lhs(a, n, n), rhs(a + square, n, n);
+        matrix_view<T> product(a + 2 * square, n, n);
+        int cutoff = n % 2 == 1 ? profile.odd_cutoff : profile.cutoff;
+#ifdef STRASSEN_OFFLOAD
+        if (offload_mul(lhs, rhs, product, cutoff)) return 0;
+#endif
+
+        strassen_algorithm algorithm = request.algorithm == 1
+                                           ? strassen_algorithm::winograd
+                                           : strassen_algorithm::classic;
+        size_t size = strassen_scratch_size(n, cutoff, spawn_depth, algorithm);
+        if (size > std::numeric_limits<size_t>::max() / sizeof(T)) return -1;
+        std::pair<size_t, std::shared_ptr<char>> scratch =
+            take_scratch(size * sizeof(T));
+
+        T* workspace = reinterpret_cast<T*>(scratch.second.get());
+        strassen_mul(lhs, rhs, product, scratch_arena<T>(workspace, size),
+                     cutoff, pool.get(), spawn_depth, algorithm);
+
+        std::lock_guard<std::mutex> guard(scratch_lock);
+        scratch_cache.push_back(scratch);
+        return 0;
+    }
+};
+
+static int serve(run_options run, tuning_profile profile) {
+    int in_flight = 2;
+    if (run.options.count("in-flight") != 0) {
+        in_flight = to_int(run.options["in-flight"]);
+    }
+    if (in_flight <= 0) return usage();
+
+    multiply_server server(run.threads, run.spawn_depth, profile, in_flight);
+    if (server.serve(run.input) != 0) {
+        std::cerr << "      Unable to listen on: \"" << run.input << "\""
+                  << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Client of a SERVE daemon, '--connect SOCKET': every one of '--requests'
+//  products gets its own shared memory segment with the inputs, all of them
+//  are sent before the first reply is read
+template <typename T>
+static int multiply_remote(run_options run) {
+    int debug = run.debug, n = run.dimension;
+    std::map<std::string, std::string>& options = run.options;
+
+    int requests = 1;
+    if (options.count("requests") != 0) requests = to_int(options["requests"]);
+    if (requests <= 0) return usage();
+
+    // Inputs from the file are shared by every request
+    std::vector<matrix_data<T>> inputs;
+    inputs.emplace_back(n);
+    inputs.emplace_back(n);
+    if ((debug & debug_flags::RANDOM) == 0 &&
+        !load_matrices(run.input, n, inputs)) {
+        std::cerr << "      Unable to open file: \"" << run.input << "\""
+                  << std::endl;
+        return -1;
+    }
+
+    size_t square = size_t(n) * n, bytes = 3 * square * sizeof(T);
+    std::vector<std::string> names;
+    std::vector<std::shared_ptr<void>> segments;
+    for (int i = 0; i < requests; ++i) {
+        names.push_back("/strassen-" + std::to_string(getpid()) + "-" +
+                        std::to_string(i));
+        int fd = shm_open(names.back().c_str(), O_CREAT | O_EXCL | O_RDWR,
+                          0600);
+        bool sized = fd >= 0 && ftruncate(fd, off_t(bytes)) == 0;
+        if (fd >= 0) close(fd);
+        if (sized) segments.push_back(map_segment(names.back(), bytes));
+        if (!sized || !segments.back()) {
+            std::cerr << "      Unable to create shared memory: \""
+                      << names.back() << "\"" << std::endl;
+            for (const std::string& name : names) shm_unlink(name.c_str());
+            return -1;
+        }
+
+        T* a = static_cast<T*>(segments.back().get());
+        for (size_t m = 0; m < 2; ++m) {
+            if ((debug & debug_flags::RANDOM) != 0) {
+                random_span(a + m * square, square, 0, 2 * i + m, run.random);
+            } else {
+                std::copy(&inputs[m].at(0), &inputs[m].at(0) + square,
+                          a + m * square);
+            }
+        }
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::string path = options["connect"];
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool connected = fd >= 0 && path.size() < sizeof(address.sun_path);
+    if (connected) {
+        std::copy(path.begin(), path.end(), address.sun_path);
+        connected = connect(fd, reinterpret_cast<sockaddr*>(&address),
+                            sizeof(address)) == 0;
+    }
+
+    // Pipelined, the replies come back in completion order
+    std::vector<serve_reply> replies(requests);
+    auto task = [&]() {
+        for (int i = 0; i < requests && connected; ++i) {
+            serve_request request = {};
+            request.id = uint64_t(i);
+            request.op = serve_multiply;
+            request.element = element_index<T>();
+            request.dimension = uint32_t(n);
+            request.algorithm =
+                run.algorithm == strassen_algorithm::winograd ? 1 : 0;
+            std::copy(names[i].begin(), names[i].end(), request.segment);
+            connected = send_all(fd, &request, sizeof(request));
+        }
+        for (int i = 0; i < requests && connected; ++i) {
+            serve_reply reply;
+            connected = recv_all(fd, &reply, sizeof(reply)) &&
+                        reply.id < uint64_t(requests);
+            if (connected) replies[reply.id] = reply;
+        }
+    };
+    if ((debug & debug_flags::TIME) != 0) {
+        std::cout << "remote: ";
+        time(task);
+    } else {
+        task();
+    }
+    if (fd >= 0) close(fd);
+    for (const std::string& name : names) shm_unlink(name.c_str());
+
+    if (!connected) {
+        std::cerr << "      Unable to reach the server: \"" << path << "\""
+                  << std::endl;
+        return -1;
+    }
+    for (const serve_reply& reply : replies) {
+        if (reply.status != 0) {
+            std::cerr << "      Request " << reply.id << " failed"
+                      << std::endl;
+            return -1;
+        }
+        if ((debug & debug_flags::TIME) != 0) {
+            std::cout << "    request " << reply.id << ": "
+                      << reply.micros / 1000.0 << "ms\n";
+        }
+    }
+
+    T* first = static_cast<T*>(segments[0].get());
+    matrix_view<T> c(first + 2 * square, n, n);
+    if ((debug & debug_flags::PRINT) != 0) {
+        std::cout << "A:\n" << matrix_view<T>(first, n, n);
+        std::cout << "B:\n" << matrix_view<T>(first + square, n, n);
+        std::cout << "C:\n" << c;
+    }
+
+    if ((debug & debug_flags::VERIFY) != 0) {
+        for (std::shared_ptr<void>& segment : segments) {
+            T* a = static_cast<T*>(segment.get());
+            matrix_view<T> lhs(a, n, n), rhs(a + square, n, n);
+            matrix_view<T> product(a + 2 * square, n, n);
+            if (!verify_product(run, lhs, rhs, product, nullptr)) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    // Print diagonal to standard output
+    if (debug == 0) {
+        for (int i = 0; i < n; ++i) std::cout << c.at(i, i) << "\n";
+    }
+    return 0;
+}
+
+// Narrow '--element' inputs of type 'N' are parsed and range checked in
+//  their own type and widened once into the accumulator type 'T' of
+//  '--accumulate'. The operand sums of the recursion already leave the
+//  range of 'N', so everything from there on, the leaf GEMM included, runs
+//  and accumulates in 'T' on its kernels: there are no narrow kernels, int8
+//  and int16 only change how the inputs are parsed and range checked
+template <typename N, typename T>
+static bool load_narrow(const std::string& path, int dimension,
+                        std::vector<matrix_data<T>>& inputs) {
+    std::vector<matrix_data<N>> narrow;
+    for (size_t i = 0; i < inputs.size(); ++i) narrow.emplace_back(dimension);
+    if (!load_matrices(path, dimension, narrow)) return false;
+
+    size_t count = size_t(dimension) * dimension;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::copy(&narrow[i].at(0), &narrow[i].at(0) + count,
+                  &inputs[i].at(0));
+    }
+    return true;
+}
+
+// Integer products are exact when every entry of 'a * b' fits 'T': the
+//  recursion computes modulo 2^bits in the unsigned type of 'T' (see
+//  'wrapping'), so only the final entries, bounded by
+//  'max_i sum_k |a_ik| * max |b|', have to stay in range. False if they
+//  might not
+template <typename T>
+static bool product_fits(matrix_view<T> a, matrix_view<T> b) {
+    if (!std::is_integral<T>::value) return true;
+
+    long double largest_row = 0, largest_b = 0;
+    for (int x = 0; x < a.rows; ++x) {
+        long double row = 0;
+        for (int y = 0; y < a.cols; ++y) {
+            row += std::abs(static_cast<long double>(a.at(x, y)));
+        }
+        largest_row = std::max(largest_row, row);
+    }
+    for (int x = 0; x < b.rows; ++x) {
+        for (int y = 0; y < b.cols; ++y) {
+            largest_b = std::max(
+                largest_b, std::abs(static_cast<long double>(b.at(x, y))));
+        }
+    }
+    return largest_row * largest_b <=
+           static_cast<long double>(std::numeric_limits<T>::max());
+}
+
+// '--modulus P': entries are reduced to '[0, P)', the inputs before and C
+//  after the product. There is no modular element type and the recursion
+//  doesn't reduce, a result that wrapped modulo 2^bits says nothing modulo
+//  'P', so the product of the reduced inputs has to be exact in 'T'
+//  ('product_fits()'), roughly 'n * P^2' within its range
+template <typename T>
+static void reduce_modulo(matrix_view<T> m, int64_t modulus) {
+    for (int x = 0; x < m.rows; ++x) {
+        T* row = m.row(x);
+        for (int y = 0; y < m.cols; ++y) {
+            row[y] = T(((int64_t(row[y]) % modulus) + modulus) % modulus);
+        }
+    }
+}
+
+// Loads or generates the inputs as 'T' elements and runs the multiplication
+template <typename T>
+static int multiply(run_options run) {
+    int debug = run.debug, dimension = run.dimension, cutoff = run.cutoff;
+    int threads = run.threads, spawn_depth = run.spawn_depth;
+    size_t batch = run.batch;
+    bool morton = run.morton;
+    strassen_algorithm algorithm = run.algorithm;
+    const std::string& input = run.input;
+    std::map<std::string, std::string>& options = run.options;
+
+    // Narrow inputs and '--modulus' only apply to square products
+    std::string element = "int32";
+    if (options.count("element") != 0) element = options["element"];
+    bool narrow = element == "int8" || element == "int16" ||
+                  (element == "int32" && !std::is_same<T, int32_t>::value);
+    int64_t modulus = 0;
+    if (options.count("modulus") != 0) {
+        modulus = std::atoll(options["modulus"].c_str());
+    }
+    bool other = options.count("shape") != 0 ||
+                 options.count("distribute") != 0 ||
+                 options.count("chain") != 0 || options.count("power") != 0 ||
+                 options.count("connect") != 0;
+    if ((narrow || options.count("modulus") != 0) && other) return usage();
+    if (options.count("modulus") != 0 &&
+        (!std::is_integral<T>::value || modulus < 2 ||
+         options.count("batch") != 0 || options.count("output") != 0 ||
+         options.count("out-of-core") != 0 ||
+         (options.count("verify") != 0 && options["verify"] != "exact"))) {
+        return usage();
+    }
+
+    if (options.count("shape") != 0) return multiply_rectangular<T>(run);
+    if (options.count("distribute") != 0) return multiply_distributed<T>(run);
+    if (options.count("chain") != 0 || options.count("power") != 0) {
+        return multiply_chain<T>(run);
+    }
+    if (options.count("connect") != 0) return multiply_remote<T>(run);
+
+    output_spec spec;
+    if (options.count("output") != 0 &&
+        !parse_output(options["output"], dimension, spec)) {
+        return usage();
+    }
+
+    numa_policy numa = numa_policy::none;
+    if (options.count("numa") != 0) {
+        if (options["numa"] == "local") {
+            numa = numa_policy::local;
+        } else if (options["numa"] == "interleave") {
+            numa = numa_policy::interleave;
+        } else if (options["numa"] != "none") {
+            return usage();
+        }
+    }
+
+    std::unique_ptr<thread_pool> pool;
+    if (threads > 1) {
+        pool.reset(new thread_pool(threads, numa != numa_policy::none
+                                                ? scatter_cpus()
+                                                : std::vector<int>()));
+    }
+    if (!pool) spawn_depth = 0;
+
+    // Allocate input matrices, A and B or the pairs of a batch
+    std::vector<matrix_data<T>> inputs;
+    for (size_t i = 0; i < 2 * batch; ++i) {
+        inputs.push_back(numa_matrix<T>(dimension, numa, pool.get()));
+    }
+    matrix_data<T>& a = inputs[0];
+    matrix_data<T>& b = inputs[1];
+
+    if ((debug & debug_flags::RANDOM) != 0) {
+        // Randomly populate matrices instead of reading from file
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            random_matrix(inputs[i], i, run.random, pool.get());
+        }
+    } else {
+        // Read data from file
+        bool loaded = false;
+        if (element == "int8") {
+            loaded = load_narrow<int8_t>(input, dimension, inputs);
+        } else if (element == "int16") {
+            loaded = load_narrow<int16_t>(input, dimension, inputs);
+        } else if (narrow) {
+            loaded = load_narrow<int32_t>(input, dimension, inputs);
+        } else {
+            loaded = load_matrices(input, dimension, inputs);
+        }
+        if (!loaded) {
+            // Error handling
+            std::cerr << "      Unable to open file: \"" << input << "\""
+                      << std::endl;
+            return -1;
+        }
+    }
+
+    // Integer products have to fit the accumulator type
+    for (size_t i = 0; i < batch; ++i) {
+        if (modulus != 0) {
+            reduce_modulo(inputs[2 * i].view(), modulus);
+            reduce_modulo(inputs[2 * i + 1].view(), modulus);
+        }
+        if (!product_fits(inputs[2 * i].view(), inputs[2 * i + 1].view())) {
+            std::cerr << "      The product can overflow "
+                      << element_names[element_index<T>()];
+            if (!std::is_same<T, int64_t>::value) {
+                std::cerr << ", use --accumulate int64";
+            }
+            std::cerr << std::endl;
+            return -1;
+        }
+    }
+
+    if (options.count("write-binary") != 0 &&
+        !save_binary(options["write-binary"], inputs)) {
+        std::cerr << "      Unable to write file: \""
+                  << options["write-binary"] << "\"" << std::endl;
+        return -1;
+    }
+
+    if (options.count("batch") != 0) {
+        return run_batch(run, inputs, cutoff, pool.get(), algorithm);
+    }
+
+    // Partial outputs skip the full product
+    if (spec.kind != output_spec::full) {
+        std::vector<T> out;
+        auto task = [&]() { out = partial_mul(a.view(), b.view(), spec); };
+        if ((debug & debug_flags::TIME) != 0) {
+            std::cout << "partial: ";
+            time(task);
+        } else {
+            task();
+        }
+
+        // Strips print as rows, everything else one value per line
+        size_t width = 1;
+        if (spec.kind == output_spec::rows) width = dimension;
+        if (spec.kind == output_spec::columns) width = spec.last - spec.first;
+        if ((debug & debug_flags::PRINT) != 0) {
+            std::cout << "A:\n" << a.view();
+            std::cout << "B:\n" << b.view();
+        }
+        if ((debug & debug_flags::PRINT) != 0 || debug == 0) {
+            for (size_t i = 0; i < out.size(); ++i) {
+                std::cout << out[i] << ((i + 1) % width == 0 ? "\n" : " ");
+            }
+        }
+
+        if ((debug & debug_flags::VERIFY) != 0) {
+            matrix_data<T> check(dimension);
+            linear_mul(a.view(), b.view(), check.view());
+            std::vector<T> expected = select_output(check.view(), spec);
+            bool equal = out.size() == expected.size();
+            for (size_t i = 0; equal && i < out.size(); ++i) {
+                equal = matches(out[i], expected[i]);
+            }
+            if (!equal) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Out-of-core runs only bring C into memory if it is printed or verified
+    std::unique_ptr<out_of_core<T>> disk;
+    if (options.count("out-of-core") != 0) {
+        size_t budget = 1024;
+        if (options.count("memory") != 0) budget = to_int(options["memory"]);
+        disk.reset(new out_of_core<T>(options["out-of-core"], budget << 20,
+                                      dimension, cutoff, pool.get(),
+                                      spawn_depth, algorithm));
+        if (!disk->ok()) {
+            std::cerr << "      Unable to create a file in: \""
+                      << options["out-of-core"] << "\"" << std::endl;
+            return -1;
+        }
+        morton = false;
+    }
+    bool full_c = !disk || (debug & (debug_flags::PRINT |
+                                     debug_flags::VERIFY)) != 0;
+
+    // C and the scratch are first touched by the tasks which write them
+    matrix_data<T> c_data =
+        numa_matrix<T>(full_c ? dimension : 0, numa, pool.get(), false);
+    matrix_view<T> c = c_data.view();
+
+    // The Morton layout pads to whole tiles and converts at the boundary
+    int levels = 0;
+    int tile = morton ? morton_tile(dimension, cutoff, levels) : 0;
+    int padded = morton ? tile << levels : dimension;
+    std::shared_ptr<T> tiled = numa_allocate<T>(
+        morton ? 3 * size_t(padded) * padded : 0, numa, pool.get());
+    size_t scratch_size =
+        disk ? 0
+             : strassen_scratch_size(padded, cutoff, spawn_depth, algorithm);
+    std::shared_ptr<T> scratch =
+        numa_allocate<T>(scratch_size, numa, pool.get(), false);
+
+    // Perform the multiplications
+    auto task = [&]() {
+        if (disk) {
+            disk->multiply(a.view(), b.view());
+            if (full_c) disk->load(c);
+            return;
+        }
+
+        scratch_arena<T> arena(scratch.get(), scratch_size);
+        if (!morton) {
+#ifdef STRASSEN_OFFLOAD
+            if (offload_mul(a.view(), b.view(), c, cutoff)) return;
+#endif
+            strassen_mul(a.view(), b.view(), c, arena, cutoff, pool.get(),
+                         spawn_depth, algorithm);
+            return;
+        }
+
+        size_t size = size_t(padded) * padded;
+        using view = matrix_view<T>;
+        view am = view::morton(tiled.get(), padded, tile);
+        view bm = view::morton(am.data + size, padded, tile);
+        view cm = view::morton(bm.data + size, padded, tile);
+
+        to_morton(a.view(), am);
+        to_morton(b.view(), bm);
+        strassen_mul(am, bm, cm, arena, cutoff, pool.get(), spawn_depth,
+                     algorithm);
+        from_morton(cm, c);
+    };
+    try {
+        if ((debug & debug_flags::TIME) != 0) {
+            reset_stats();
+            std::cout << "strassen: ";
+            time(task);
+            print_stats(std::cout);
+        } else {
+            task();
+        }
+    } catch (const std::runtime_error& error) {
+        std::cerr << "      " << error.what() << std::endl;
+        return -1;
+    }
+    if (modulus != 0) reduce_modulo(c, modulus);
+
+    if ((debug & debug_flags::PRINT) != 0) {
+        std::cout << "A:\n" << a.view();
+        std::cout << "B:\n" << b.view();
+        std::cout << "C:\n" << c;
+    }
+
+    if ((debug & debug_flags::VERIFY) != 0) {
+        if (!verify_product(run, a.view(), b.view(), c, pool.get())) {
+            std::cerr << "      Verification failed" << std::endl;
+            return -1;
         }
-        assert(submatrix(c) == submatrix(check));
     }
 
     // Print diagonal to standard output
     if (debug == 0) {
         for (int i = 0; i < dimension; ++i) {
-            std::cout << c.at(i, i) << "\n";
+            std::cout << (full_c ? c.get(i, i) : disk->diagonal(i)) << "\n";
+        }
+    }
+    return 0;
+}
+
+// Boolean mode: A and B are packed to one bit per entry (nonzero entries are
+//  ones) and multiplied either counting, which is the integer product of the
+//  0/1 matrices, or over GF(2)
+static int multiply_boolean(run_options run) {
+    int debug = run.debug, dimension = run.dimension;
+    std::string mode = run.options["boolean"];
+    bool gf2 = mode == "gf2";
+    if (!gf2 && mode != "count") return usage();
+
+    bit_matrix a(dimension), b(dimension);
+    if ((debug & debug_flags::RANDOM) != 0) {
+        // Randomly populate matrices instead of reading from file, rows
+        //  of 'dimension' entries at a time
+        std::vector<int> row(dimension);
+        bit_matrix* matrices[2] = {&a, &b};
+        for (int m = 0; m < 2; ++m) {
+            for (int i = 0; i < dimension; ++i) {
+                random_span(row.data(), row.size(), size_t(i) * dimension, m,
+                            run.random);
+                for (int j = 0; j < dimension; ++j) {
+                    if (row[j] != 0) matrices[m]->set(i, j);
+                }
+            }
+        }
+    } else {
+        // Read data from file, the unpacked inputs are dropped right away
+        std::vector<matrix_data<int>> inputs;
+        inputs.emplace_back(dimension);
+        inputs.emplace_back(dimension);
+        if (!load_matrices(run.input, dimension, inputs)) {
+            // Error handling
+            std::cerr << "      Unable to open file: \"" << run.input << "\""
+                      << std::endl;
+            return -1;
+        }
+        a = bit_matrix::pack(inputs[0].view());
+        b = bit_matrix::pack(inputs[1].view());
+    }
+
+    std::unique_ptr<thread_pool> pool;
+    if (run.threads > 1) pool.reset(new thread_pool(run.threads));
+
+    // Counts are integers, GF(2) products stay packed
+    matrix_data<int> counts(gf2 ? 0 : dimension);
+    bit_matrix product(gf2 ? dimension : 0);
+
+    // Perform the multiplications
+    auto task = [&]() {
+        if (gf2) {
+            bit_gf2_mul(a, b, product, pool.get());
+        } else {
+            bit_count_mul(a, b.transposed(), counts.view(), pool.get());
+        }
+    };
+    if ((debug & debug_flags::TIME) != 0) {
+        std::cout << "boolean " << mode << ": ";
+        time(task);
+    } else {
+        task();
+    }
+
+    auto entry = [&](int i, int j) {
+        return gf2 ? int(product.get(i, j)) : counts.at(i, j);
+    };
+
+    if ((debug & (debug_flags::PRINT | debug_flags::VERIFY)) != 0) {
+        matrix_data<int> a_data(dimension), b_data(dimension);
+        matrix_data<int> c_data(dimension), check(dimension);
+        a.unpack(a_data.view());
+        b.unpack(b_data.view());
+        for (int i = 0; i < dimension; ++i) {
+            for (int j = 0; j < dimension; ++j) c_data.at(i, j) = entry(i, j);
+        }
+
+        if ((debug & debug_flags::PRINT) != 0) {
+            std::cout << "A:\n" << a_data.view();
+            std::cout << "B:\n" << b_data.view();
+            std::cout << "C:\n" << c_data.view();
+        }
+
+        if ((debug & debug_flags::VERIFY) != 0) {
+            linear_mul(a_data.view(), b_data.view(), check.view());
+            if (gf2) {
+                for (size_t i = 0; i < size_t(dimension) * dimension; ++i) {
+                    check.at(i) &= 1;
+                }
+            }
+            if (!(c_data.view() == check.view())) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    // Print diagonal to standard output
+    if (debug == 0) {
+        for (int i = 0; i < dimension; ++i) std::cout << entry(i, i) << "\n";
+    }
+    return 0;
+}
+
+// Graph mode: counts the triangles of G(n, p) random graphs as
+//  'trace(A^3) / 6' for every 'p' of a comma separated list. Only 'A^2' is
+//  a Strassen product, the diagonal of 'A^3' is the dot product of row 'i'
+//  of 'A^2' with column 'i' of 'A', which is row 'i' for the symmetric 'A'
+static int count_triangles(run_options run) {
+    int debug = run.debug, n = run.dimension, cutoff = run.cutoff;
+    int spawn_depth = run.spawn_depth;
+
+    std::vector<double> probabilities;
+    std::stringstream list(run.options["triangles"]);
+    for (std::string item; getline(list, item, ',');) {
+        double p = std::atof(item.c_str());
+        if (p < 0 || p > 1) return usage();
+        probabilities.push_back(p);
+    }
+    if (probabilities.empty()) return usage();
+
+    std::unique_ptr<thread_pool> pool;
+    if (run.threads > 1) pool.reset(new thread_pool(run.threads));
+    if (!pool) spawn_depth = 0;
+
+    // Shared by all graphs of the sweep
+    matrix_data<int> a(n);
+    strassen_plan<int> plan(n, cutoff, false, pool.get(), spawn_depth,
+                            run.algorithm);
+
+    for (size_t graph = 0; graph < probabilities.size(); ++graph) {
+        double p = probabilities[graph];
+        uint64_t key = random_key(run.random.seed, graph);
+
+        // Symmetric adjacency matrix without self loops
+        for (int i = 0; i < n; ++i) {
+            a.at(i, i) = 0;
+            for (int j = i + 1; j < n; ++j) {
+                uint64_t pair = size_t(i) * n + j;
+                int edge = random_unit(random_bits(key, pair)) < p;
+                a.at(i, j) = edge;
+                a.at(j, i) = edge;
+            }
+        }
+
+        int64_t trace = 0;
+        auto start = std::chrono::steady_clock::now();
+        using operand = strassen_plan<int>::operand;
+        operand adjacency = plan.load(a.view());
+        operand square = plan.multiply(adjacency, adjacency);
+        for (int i = 0; i < n; ++i) {
+            trace += kernels<int>.dot(square.view.row(i), a.view().row(i), n);
+        }
+        std::chrono::duration<double> seconds =
+            std::chrono::steady_clock::now() - start;
+
+        // Every triangle is counted once per corner and direction
+        int64_t triangles = trace / 6;
+        double expected = double(n) * (n - 1) * (n - 2) / 6 * p * p * p;
+        double ops = 2.0 * n * n * n / seconds.count();
+        std::cout << "p " << p << ": " << triangles << " triangles (expected "
+                  << std::llround(expected) << "), " << seconds.count() * 1e3
+                  << "ms, "
+                  << ops * 1e-9 << " effective Gops/s\n";
+
+        if ((debug & debug_flags::PRINT) != 0) {
+            std::cout << "A:\n" << a.view();
+        }
+
+        if ((debug & debug_flags::VERIFY) != 0) {
+            matrix_data<int> check(n), cube(n);
+            linear_mul(a.view(), a.view(), check.view());
+            linear_mul(check.view(), a.view(), cube.view());
+            int64_t check_trace = 0;
+            for (int i = 0; i < n; ++i) check_trace += cube.at(i, i);
+            if (check_trace != trace) {
+                std::cerr << "      Verification failed" << std::endl;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Textbook triple loop, the baseline the other algorithms are measured
+//  against
+template <typename T>
+static void naive_mul(matrix_view<T> a, matrix_view<T> b, matrix_view<T> c) {
+    int n = c.dimension;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            T sum = 0;
+            for (int k = 0; k < n; ++k) sum += a.at(i, k) * b.at(k, j);
+            c.at(i, j) = sum;
+        }
+    }
+}
+
+// One row of the benchmark report, times in milliseconds
+struct bench_result {
+    std::string algorithm;
+    int dimension, cutoff, threads, runs;
+    double median, p95, best, gops;
+};
+
+// Benchmark mode: every combination of '--thread-counts', '--sizes',
+//  '--cutoffs' and '--algorithms' is run '--warmup' times untimed and
+//  '--repeat' times timed. Gop/s counts the '2 n^3' operations of the
+//  classic product for every algorithm, so they compare directly. The
+//  leaf GEMM and the triple loop ignore the cutoff and the threads and only
+//  run once per size
+template <typename T>
+static int benchmark(run_options run) {
+    std::map<std::string, std::string>& options = run.options;
+
+    std::vector<int> sizes, cutoffs, thread_counts;
+    if (!parse_counts(options, "sizes", run.dimension, sizes) ||
+        !parse_counts(options, "cutoffs", run.cutoff, cutoffs) ||
+        !parse_counts(options, "thread-counts", run.threads, thread_counts)) {
+        return usage();
+    }
+
+    std::vector<std::string> algorithms = {"strassen", "winograd", "blocked",
+                                           "linear"};
+    if (options.count("algorithms") != 0) {
+        algorithms.clear();
+        std::stringstream list(options["algorithms"]);
+        for (std::string item; getline(list, item, ',');) {
+            if (item != "strassen" && item != "winograd" &&
+                item != "blocked" && item != "linear") {
+                return usage();
+            }
+            algorithms.push_back(item);
+        }
+        if (algorithms.empty()) return usage();
+    }
+
+    int warmup = 1, repeat = 5;
+    if (options.count("warmup") != 0) warmup = to_int(options["warmup"]);
+    if (options.count("repeat") != 0) repeat = to_int(options["repeat"]);
+    double peak = 0;
+    if (options.count("peak") != 0) peak = std::atof(options["peak"].c_str());
+    if (warmup < 0 || repeat <= 0 || peak < 0) return usage();
+
+    std::string element = "int32";
+    if (options.count("element") != 0) element = options["element"];
+
+    std::ofstream file;
+    bool json = run.input.size() >= 5 &&
+                run.input.compare(run.input.size() - 5, 5, ".json") == 0;
+    if (run.input != "-") {
+        file.open(run.input);
+        if (!file.is_open()) {
+            std::cerr << "      Unable to write file: \"" << run.input << "\""
+                      << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& out = run.input == "-" ? std::cout : file;
+
+    std::vector<bench_result> results;
+    for (int threads : thread_counts) {
+        std::unique_ptr<thread_pool> pool;
+        if (threads > 1) pool.reset(new thread_pool(threads));
+        int spawn_depth = pool ? default_spawn_depth(threads) : 0;
+        if (pool && options.count("spawn-depth") != 0) {
+            spawn_depth = to_int(options["spawn-depth"]);
+        }
+
+        for (int n : sizes) {
+            matrix_data<T> a(n), b(n), c(n);
+            random_matrix(a, 0, run.random, pool.get());
+            random_matrix(b, 1, run.random, pool.get());
+
+            for (int cutoff : cutoffs) {
+                for (const std::string& name : algorithms) {
+                    bool recursive = name == "strassen" || name == "winograd";
+                    if (!recursive && (threads != thread_counts[0] ||
+                                       cutoff != cutoffs[0])) {
+                        continue;
+                    }
+
+                    strassen_algorithm algorithm =
+                        name == "winograd" ? strassen_algorithm::winograd
+                                           : strassen_algorithm::classic;
+                    std::vector<T> scratch(
+                        recursive ? strassen_scratch_size(n, cutoff,
+                                                          spawn_depth,
+                                                          algorithm)
+                                  : 0);
+                    auto task = [&]() {
+                        if (name == "linear") {
+                            naive_mul(a.view(), b.view(), c.view());
+                        } else if (name == "blocked") {
+                            c.view().clear();
+                            linear_mul(a.view(), b.view(), c.view());
+                        } else {
+                            strassen_mul(a.view(), b.view(), c.view(),
+                                         scratch_arena<T>(scratch.data(),
+                                                          scratch.size()),
+                                         cutoff, pool.get(), spawn_depth,
+                                         algorithm);
+                        }
+                    };
+
+                    for (int i = 0; i < warmup; ++i) task();
+                    std::vector<double> times;
+                    for (int i = 0; i < repeat; ++i) {
+                        auto start = std::chrono::steady_clock::now();
+                        task();
+                        std::chrono::duration<double, std::milli> ms =
+                            std::chrono::steady_clock::now() - start;
+                        times.push_back(ms.count());
+                    }
+
+                    // Nearest rank percentiles
+                    std::sort(times.begin(), times.end());
+                    bench_result result{name,
+                                        n,
+                                        recursive ? cutoff : 0,
+                                        recursive ? threads : 1,
+                                        repeat,
+                                        times[(repeat - 1) / 2],
+                                        times[(95 * repeat + 99) / 100 - 1],
+                                        times[0],
+                                        0};
+                    result.gops = 2e-6 * n * n * double(n) / result.median;
+                    results.push_back(result);
+
+                    if (run.input != "-") {
+                        std::cout << "    " << name << " " << n << " cutoff "
+                                  << result.cutoff << " threads "
+                                  << result.threads << ": " << result.median
+                                  << "ms, " << result.gops << " Gops/s\n";
+                    }
+                }
+            }
+        }
+    }
+
+    // Report, one CSV row or JSON object per configuration
+    auto share = [&](const bench_result& result) {
+        return 100 * result.gops / peak;
+    };
+    if (json) {
+        out << "{\n  \"kernel\": \"" << kernels<T>.name
+            << "\",\n  \"element\": \"" << element
+            << "\",\n  \"results\": [\n";
+    } else {
+        out << "kernel,element,algorithm,dimension,cutoff,threads,runs,"
+               "median_ms,p95_ms,min_ms,gops"
+            << (peak > 0 ? ",peak_percent" : "") << "\n";
+    }
+    for (size_t i = 0; i < results.size(); ++i) {
+        const bench_result& r = results[i];
+        if (json) {
+            out << "    {\"algorithm\": \"" << r.algorithm
+                << "\", \"dimension\": " << r.dimension
+                << ", \"cutoff\": " << r.cutoff
+                << ", \"threads\": " << r.threads << ", \"runs\": " << r.runs
+                << ", \"median_ms\": " << r.median
+                << ", \"p95_ms\": " << r.p95 << ", \"min_ms\": " << r.best
+                << ", \"gops\": " << r.gops;
+            if (peak > 0) out << ", \"peak_percent\": " << share(r);
+            out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        } else {
+            out << kernels<T>.name << "," << element << "," << r.algorithm
+                << "," << r.dimension << "," << r.cutoff << "," << r.threads
+                << "," << r.runs << "," << r.median << "," << r.p95 << ","
+                << r.best << "," << r.gops;
+            if (peak > 0) out << "," << share(r);
+            out << "\n";
+        }
+    }
+    if (json) out << "  ]\n}\n";
+
+    if (!out) {
+        std::cerr << "      Unable to write file: \"" << run.input << "\""
+                  << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, const char** argv) {
+#ifdef STRASSEN_MPI
+    mpi_session mpi;
+#endif
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::map<std::string, std::string> options;
+
+    if (!parse_options(args, options) || args.size() != 3) return usage();
+
+    // Parse input parameters
+    int debug = to_int(args.at(0));
+    int dimension = to_int(args.at(1));
+    int cutoff = 32;
+
+    int threads = 1;
+    if (options.count("threads") != 0) threads = to_int(options["threads"]);
+    int spawn_depth = default_spawn_depth(threads);
+    if (options.count("spawn-depth") != 0) {
+        spawn_depth = to_int(options["spawn-depth"]);
+    }
+
+    bool morton = options.count("layout") != 0 && options["layout"] == "morton";
+    if (options.count("layout") != 0 && !morton &&
+        options["layout"] != "row-major") {
+        return usage();
+    }
+
+    strassen_algorithm algorithm = strassen_algorithm::classic;
+    if (options.count("algorithm") != 0) {
+        if (options["algorithm"] == "winograd") {
+            algorithm = strassen_algorithm::winograd;
+        } else if (options["algorithm"] != "classic") {
+            return usage();
+        }
+    }
+
+    size_t batch = 1;
+    if (options.count("batch") != 0) batch = size_t(to_int(options["batch"]));
+
+    if (dimension <= 0 || threads <= 0 || spawn_depth < 0 || batch == 0 ||
+        batch > size_t(INT32_MAX)) {
+        return usage();
+    }
+
+    if ((debug & debug_flags::TUNE) != 0) return tune(dimension, args.at(2));
+
+    // Use the tuned cutoffs of this machine when there are any
+    tuning_profile profile;
+    std::string profile_path = default_profile_path();
+    if (options.count("profile") != 0) profile_path = options["profile"];
+    if (load_profile(profile_path, profile)) {
+        cutoff = dimension % 2 == 1 ? profile.odd_cutoff : profile.cutoff;
+    }
+
+    // An explicit cutoff overrides the profile
+    bool generated = (debug & debug_flags::RANDOM) != 0 ||
+                     options.count("triangles") != 0;
+    if (generated && to_int(args.at(2)) > 0) {
+        cutoff = to_int(args.at(2));
+    }
+
+    run_options run{debug, dimension, cutoff, threads,
+                    spawn_depth, morton, algorithm, batch,
+                    args.at(2), options, random_spec()};
+    if (!parse_random(options, run.random)) return usage();
+    if (options.count("verify") != 0 && options["verify"] != "exact" &&
+        options["verify"] != "freivalds") {
+        return usage();
+    }
+    if (options.count("rounds") != 0 && to_int(options["rounds"]) <= 0) {
+        return usage();
+    }
+
+    // Reruns with '--seed' repeat the inputs of a timed run
+    if ((debug & debug_flags::TIME) != 0 &&
+        (generated || (debug & debug_flags::BENCH) != 0)) {
+        std::cout << "seed: " << run.random.seed << "\n";
+    }
+
+    if ((debug & debug_flags::SERVE) != 0) return serve(run, profile);
+
+    if (options.count("boolean") != 0) return multiply_boolean(run);
+    if (options.count("triangles") != 0) return count_triangles(run);
+
+    // Narrow integer inputs accumulate in int32 unless '--accumulate' widens
+    //  them further, every other element type is its own accumulator
+    std::string element = "int32";
+    if (options.count("element") != 0) element = options["element"];
+    std::string accumulate = element;
+    if (element == "int8" || element == "int16") accumulate = "int32";
+    if (options.count("accumulate") != 0) accumulate = options["accumulate"];
+
+    std::map<std::string, int> integer_bits = {
+        {"int8", 8}, {"int16", 16}, {"int32", 32}, {"int64", 64}};
+    bool widened = integer_bits.count(element) != 0 &&
+                   integer_bits.count(accumulate) != 0 &&
+                   integer_bits[accumulate] >= 32 &&
+                   integer_bits[accumulate] >= integer_bits[element];
+    if (accumulate != element && !widened) return usage();
+    if (integer_bits.count(element) != 0) {
+        int64_t limit = std::numeric_limits<int64_t>::max() >>
+                        (64 - integer_bits[element]);
+        if (run.random.low < -limit - 1 || run.random.high > limit) {
+            return usage();
         }
     }
+
+    element = accumulate;
+    bool bench = (debug & debug_flags::BENCH) != 0;
+    if (element == "int32") {
+        return bench ? benchmark<int32_t>(run) : multiply<int32_t>(run);
+    }
+    if (element == "int64") {
+        return bench ? benchmark<int64_t>(run) : multiply<int64_t>(run);
+    }
+    if (element == "float") {
+        return bench ? benchmark<float>(run) : multiply<float>(run);
+    }
+    if (element == "double") {
+        return bench ? benchmark<double>(run) : multiply<double>(run);
+    }
+    return usage();
 }
+